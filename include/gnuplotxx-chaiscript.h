@@ -312,6 +312,15 @@ inline chaiscript::ModulePtr library() {
   smooths["Unwrap"] = const_var(Smooth::Unwrap);
   lib->add_global_const(const_var(smooths), "Smooths");
 
+  utility::add_class<DataFormat>(*lib, "DataFormat",
+                                 {{DataFormat::Text, "DataFormat_Text"},
+                                  {DataFormat::Binary, "DataFormat_Binary"}});
+
+  auto dataFormats = dispatch::Dynamic_Object("DataFormats");
+  dataFormats["Text"] = const_var(DataFormat::Text);
+  dataFormats["Binary"] = const_var(DataFormat::Binary);
+  lib->add_global_const(const_var(dataFormats), "DataFormats");
+
   bootstrap::standard_library::pair_type<Point>("Point", *lib);
   bootstrap::standard_library::pair_type<Size>("Size", *lib);
 
@@ -440,6 +449,28 @@ inline chaiscript::ModulePtr library() {
         }),
         "value"}});
 
+  utility::add_class<std::optional<int>>(
+      *lib, "OptionalInt",
+      {constructor<std::optional<int>()>(),
+       constructor<std::optional<int>(int)>(),
+       constructor<std::optional<int>(const std::optional<int> &)>()},
+      {{fun(&std::optional<int>::has_value), "has_value"},
+       {fun([](const std::optional<int> &self) -> int {
+          return self.value();
+        }),
+        "value"}});
+
+  utility::add_class<std::optional<double>>(
+      *lib, "OptionalDouble",
+      {constructor<std::optional<double>()>(),
+       constructor<std::optional<double>(double)>(),
+       constructor<std::optional<double>(const std::optional<double> &)>()},
+      {{fun(&std::optional<double>::has_value), "has_value"},
+       {fun([](const std::optional<double> &self) -> double {
+          return self.value();
+        }),
+        "value"}});
+
   utility::add_class<Series>(
       *lib, "Series",
       {constructor<Series(const Series &)>(), constructor<Series(Series &&)>()},
@@ -448,7 +479,7 @@ inline chaiscript::ModulePtr library() {
           return self.title(std::move(title));
         }),
         "title"},
-       {fun<const std::string &, Series>(&Series::title), "title"},
+       {fun<std::string, Series>(&Series::title), "title"},
        {fun([](Series &self, PlotStyle plotStyle) -> Series {
           return self.with(plotStyle);
         }),
@@ -496,6 +527,20 @@ inline chaiscript::ModulePtr library() {
         }),
         "axes"},
        {fun<AxesPair, Series>(&Series::axes), "axes"},
+       {fun([](Series &self, DataFormat format) -> Series {
+          return self.dataFormat(format);
+        }),
+        "dataFormat"},
+       {fun<DataFormat, Series>(&Series::dataFormat), "dataFormat"},
+       {fun([](Series &self, std::optional<int> precision) -> Series {
+          return self.precision(precision);
+        }),
+        "precision"},
+       {fun([](Series &self, int precision) -> Series {
+          return self.precision(precision);
+        }),
+        "precision"},
+       {fun<std::optional<int>, Series>(&Series::precision), "precision"},
        {fun([](Series &self, double v0, double v1) -> Series {
           return self.append(v0, v1);
         }),
@@ -584,6 +629,25 @@ inline chaiscript::ModulePtr library() {
         }),
         "range"},
        {fun<const Range &, Plot, Axis>(&Plot::range), "range"},
+       {fun([](Plot &self, bool async) -> Plot { return self.async(async); }),
+        "async"},
+       {fun<bool, Plot>(&Plot::async), "async"},
+       {fun(&Plot::flush), "flush"},
+       {fun([](Plot &self, std::optional<double> fps) -> Plot {
+          return self.autoUpdate(fps);
+        }),
+        "autoUpdate"},
+       {fun([](Plot &self, double fps) -> Plot {
+          return self.autoUpdate(fps);
+        }),
+        "autoUpdate"},
+       {fun<std::optional<double>, Plot>(&Plot::autoUpdate), "autoUpdate"},
+       {fun(&Plot::frame), "frame"},
+       {fun(&Plot::renderedFrame), "renderedFrame"},
+       {fun([](Plot &self, std::uint64_t frame) -> bool {
+          return self.waitFrame(frame);
+        }),
+        "waitFrame"},
        {fun<Series, Plot, std::string>(&Plot::createSeries), "createSeries"},
        {fun<Series, Plot, std::string, const Series &>(&Plot::createSeries),
         "createSeries"},
@@ -22,10 +22,24 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <chrono>
 #include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <system_error>
 #include <thread>
 #include <tuple>
@@ -36,12 +50,31 @@
 #include <vector>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
 #include <signal.h>
 #include <sys/epoll.h>
-#include <sys/prctl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+// io_uring support needs the kernel headers; define GNUPLOTXX_HAS_IO_URING as 0
+// to leave it out
+#if !defined(GNUPLOTXX_HAS_IO_URING)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define GNUPLOTXX_HAS_IO_URING 1
+#else
+#define GNUPLOTXX_HAS_IO_URING 0
+#endif
+#endif
+
+#if GNUPLOTXX_HAS_IO_URING
+#include <linux/io_uring.h>
+#endif
+
 #if defined(__has_include) && __has_include(<fmt/format.h>)
 #include <fmt/format.h>
 #else
@@ -306,6 +339,11 @@ enum class Smooth {
   Unwrap,
 };
 
+enum class DataFormat {
+  Text,
+  Binary,
+};
+
 namespace detail {
 
 static inline std::unordered_map<PlotStyle, std::string_view> plotStyleLUT = {
@@ -567,7 +605,9 @@ namespace detail {
 template <typename T, std::size_t I = 0>
 constexpr bool isTupleLikeOfNumbersHelper() {
   using std::get;
-  if constexpr (I < std::tuple_size_v<T>) {
+  if constexpr (!requires { std::tuple_size<T>::value; }) {
+    return false;
+  } else if constexpr (I < std::tuple_size_v<T>) {
     bool ret = requires(T t) { IsNumberV<decltype(get<I>(t))>; };
 
     if constexpr (I < std::tuple_size_v<T> - 1)
@@ -596,45 +636,10 @@ struct SeriesDataPriv;
 using SeriesDataPrivPtr = std::shared_ptr<SeriesDataPriv>;
 
 struct SeriesPriv;
-using SeriesPrivPtr = std::shared_ptr<SeriesPriv>;
 
 struct PlotPriv;
 using PlotPrivPtr = std::shared_ptr<PlotPriv>;
 
-struct SeriesDataPriv {
-  SeriesDataPriv(int id) : id(id) {}
-
-  bool empty() const { return buf.empty(); }
-
-  int id;
-  std::string buf;
-  bool dirty;
-};
-
-struct SeriesPriv {
-  SeriesPriv(PlotPriv &plot, SeriesDataPrivPtr data, std::string title)
-      : plot(plot), data(data), title(std::move(title)),
-        plotStyle(PlotStyle::Points), lineWidth(1.0), pointSize(1.0),
-        axes(Axes::X1Y1), axesDirty(true) {}
-
-  PlotPriv &plot;
-
-  SeriesDataPrivPtr data;
-
-  std::string title;
-  PlotStyle plotStyle;
-  std::optional<Color> color;
-  double lineWidth;
-  std::optional<PointType> pointType;
-  double pointSize;
-  std::optional<Smooth> smooth;
-  AxesPair axes;
-
-  bool dirty;
-  bool axesDirty;
-  bool removed;
-};
-
 inline bool close(int fd) {
   while (::close(fd) < 0) {
     if (errno != EINTR)
@@ -653,9 +658,9 @@ inline bool dup2(int oldfd, int newfd) {
   return true;
 }
 
-inline int open(const char *pathname, int flags) {
+inline int open(const char *pathname, int flags, mode_t mode = 0) {
   int fd;
-  while ((fd = ::open(pathname, flags)) < 0) {
+  while ((fd = ::open(pathname, flags, mode)) < 0) {
     if (errno != EINTR)
       break;
   }
@@ -673,13 +678,27 @@ inline ssize_t read(int fd, void *buf, size_t count) {
   return ret;
 }
 
-inline bool writeAll(int fd, const void *buf, std::size_t count) {
+// Called when a non-blocking FD is full, returns once it is writable again or
+// false on error
+using WaitWritable = std::function<bool()>;
+
+// Handles a failed write: retries after EINTR, and after EAGAIN once wait()
+// reports the FD writable again
+inline bool retryWrite(const WaitWritable &wait) {
+  if (errno == EINTR)
+    return true;
+
+  return (errno == EAGAIN || errno == EWOULDBLOCK) && wait && wait();
+}
+
+inline bool writeAll(int fd, const void *buf, std::size_t count,
+                     const WaitWritable &wait = {}) {
   ssize_t ret = 0, written = 0;
   const std::byte *p = static_cast<const std::byte *>(buf);
 
   do {
     ret = ::write(fd, static_cast<const void *>(p + written), count - written);
-    if (ret < 0 && errno != EINTR) {
+    if (ret < 0 && !retryWrite(wait)) {
       return false;
     } else if (ret >= 0) {
       written += ret;
@@ -689,541 +708,3129 @@ inline bool writeAll(int fd, const void *buf, std::size_t count) {
   return true;
 }
 
-inline bool writeAll(int fd, const std::string &buf) {
-  return writeAll(fd, buf.data(), buf.size());
+inline bool writeAll(int fd, std::string_view buf,
+                     const WaitWritable &wait = {}) {
+  return writeAll(fd, buf.data(), buf.size(), wait);
 }
 
-class Process final {
-public:
-  Process() : m_fd(-1) {
-    int stdinFds[2], execErrFds[2];
+// Gathers the buffers into as few writev() calls as possible
+inline bool writeAll(int fd, std::span<const std::string> bufs,
+                     const WaitWritable &wait = {}) {
+  std::array<iovec, 256> iov;
+  std::size_t first = 0, offset = 0;
 
-    if (::pipe(stdinFds) < 0)
-      throw std::system_error(errno, std::generic_category(),
-                              "Process: pipe (stdin FDs)");
-    if (::pipe(execErrFds) < 0)
-      throw std::system_error(errno, std::generic_category(),
-                              "Process: pipe (exec error FDs)");
+  for (;;) {
+    while (first < bufs.size() && bufs[first].size() == offset) {
+      ++first;
+      offset = 0;
+    }
 
-    if (::fcntl(execErrFds[1], F_SETFD, FD_CLOEXEC) < 0)
-      throw std::system_error(errno, std::generic_category(), "Process: fcntl");
+    if (first == bufs.size())
+      return true;
 
-    if ((m_pid = ::fork()) < 0)
-      throw std::system_error(errno, std::generic_category(), "Process: fork");
+    int count = 0;
+    for (auto i = first; i < bufs.size() && count < (int)iov.size(); ++i) {
+      std::size_t skip = i == first ? offset : 0;
+      iov[count++] = {.iov_base = const_cast<char *>(bufs[i].data()) + skip,
+                      .iov_len = bufs[i].size() - skip};
+    }
 
-    if (m_pid == 0) {
-      auto raiseError = [errFd = execErrFds[1]](int err, std::string_view msg) {
-        writeAll(errFd, &err, sizeof(err));
-        writeAll(errFd, msg.data(), msg.size());
-        ::exit(-1);
-      };
+    ssize_t ret = ::writev(fd, iov.data(), count);
+    if (ret < 0) {
+      if (!retryWrite(wait))
+        return false;
+      continue;
+    }
 
-      close(execErrFds[0]);
-      close(stdinFds[1]);
+    // Skip the written bytes
+    for (auto n = static_cast<std::size_t>(ret); n > 0;) {
+      std::size_t left = bufs[first].size() - offset;
+      if (n < left) {
+        offset += n;
+        break;
+      }
 
-      if (!dup2(stdinFds[0], STDIN_FILENO))
-        raiseError(errno, "child: dup2 (stdin)");
+      n -= left;
+      ++first;
+      offset = 0;
+    }
+  }
+}
 
-      close(stdinFds[0]);
+// Blocks SIGPIPE for the calling thread while in scope, so that writing to a
+// pipe whose reader has exited fails with EPIPE instead of killing us. It costs
+// nothing when SIGPIPE is ignored (checked once, at the first write) or when
+// the thread blocked it for good (see blockForThread()).
+class SigPipeBlocker final {
+public:
+  SigPipeBlocker() : m_active(!ignored() && !t_blocked) {
+    if (!m_active)
+      return;
 
-      int nullFd = open("/dev/null", O_WRONLY);
-      if (nullFd < 0)
-        raiseError(errno, "child: open (/dev/null)");
+    sigset_t pending;
+    ::sigemptyset(&m_set);
+    ::sigaddset(&m_set, SIGPIPE);
+    ::sigpending(&pending);
 
-      if (!dup2(nullFd, STDOUT_FILENO))
-        raiseError(errno, "child: dup2 (stdout)");
-      if (!dup2(nullFd, STDERR_FILENO))
-        raiseError(errno, "child: dup2 (stderr)");
+    // Leave a SIGPIPE raised by somebody else alone
+    m_wasPending = ::sigismember(&pending, SIGPIPE) == 1;
+    ::pthread_sigmask(SIG_BLOCK, &m_set, &m_oldSet);
+  }
 
-      close(nullFd);
+  SigPipeBlocker(const SigPipeBlocker &) = delete;
+  SigPipeBlocker &operator=(const SigPipeBlocker &) = delete;
 
-      ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+  // Discards the SIGPIPE our writes raised
+  ~SigPipeBlocker() {
+    if (!m_active)
+      return;
 
-      ::execlp("gnuplot", "gnuplot", "-d", (char *)NULL);
+    int err = errno;
 
-      raiseError(errno, "execlp");
+    if (!m_wasPending) {
+      timespec zero = {0, 0};
+      while (::sigtimedwait(&m_set, nullptr, &zero) < 0 && errno == EINTR)
+        ;
     }
 
-    close(stdinFds[0]);
-    close(execErrFds[1]);
-
-    int epollFd;
-
-    if ((epollFd = ::epoll_create1(0)) < 0)
-      throw std::system_error(errno, std::generic_category(),
-                              "Process: epoll_create1");
+    ::pthread_sigmask(SIG_SETMASK, &m_oldSet, nullptr);
+    errno = err;
+  }
 
-    epoll_event events[1] = {{.events = EPOLLIN, .data = {}}};
+  // Blocks SIGPIPE for the rest of the calling thread's life; only for our
+  // own threads, which have no use for it
+  static void blockForThread() {
+    sigset_t set;
+    ::sigemptyset(&set);
+    ::sigaddset(&set, SIGPIPE);
+    ::pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    t_blocked = true;
+  }
 
-    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, execErrFds[0], &events[0]) < 0)
-      throw std::system_error(errno, std::generic_category(),
-                              "Process: epoll_ctl");
+private:
+  static bool ignored() {
+    static const bool ignored = [] {
+      struct sigaction action = {};
+      return ::sigaction(SIGPIPE, nullptr, &action) == 0 &&
+             action.sa_handler == SIG_IGN;
+    }();
+
+    return ignored;
+  }
 
-    while (::epoll_wait(epollFd, events, 1, -1) < 0) {
-      if (errno != EINTR)
-        throw std::system_error(errno, std::generic_category(),
-                                "Process: epoll_wait");
-    }
+  static inline thread_local bool t_blocked = false;
 
-    int err, ret;
-    if ((ret = read(execErrFds[0], &err, sizeof(err))) < 0)
-      throw std::system_error(errno, std::generic_category(),
-                              "Process: read (exec error FD) error code");
+  bool m_active;
+  bool m_wasPending = false;
+  sigset_t m_set;
+  sigset_t m_oldSet;
+};
 
-    if (ret > 0) {
-      std::size_t size, maxSize = 128;
-      std::string msg;
+// Lock-free single-producer single-consumer ring buffer
+template <typename T, std::size_t N> class SpscQueue final {
+public:
+  SpscQueue() : m_head(0), m_tail(0) {}
 
-      msg.reserve(maxSize);
-      msg += "Process: failed to exec gnuplot: ";
-      size = msg.size();
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
 
-      if ((ret = read(execErrFds[0], &msg[size], maxSize - size)) < 0)
-        throw std::system_error(errno, std::generic_category(),
-                                "Process: read (exec error FD) error message");
+  // Blocks while the queue is full
+  void push(T value) {
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    for (auto head = m_head.load(std::memory_order_acquire); tail - head == N;
+         head = m_head.load(std::memory_order_acquire))
+      m_head.wait(head, std::memory_order_acquire);
 
-      msg.resize(size + ret);
+    m_slots[tail % N] = std::move(value);
+    m_tail.store(tail + 1, std::memory_order_release);
+    m_tail.notify_one();
+  }
 
-      throw std::system_error(err, std::generic_category(), msg);
-    }
+  // Blocks while the queue is empty
+  T pop() {
+    auto head = m_head.load(std::memory_order_relaxed);
+    for (auto tail = m_tail.load(std::memory_order_acquire); tail == head;
+         tail = m_tail.load(std::memory_order_acquire))
+      m_tail.wait(tail, std::memory_order_acquire);
 
-    close(execErrFds[1]);
-    close(epollFd);
+    T value = std::move(m_slots[head % N]);
+    m_head.store(head + 1, std::memory_order_release);
+    m_head.notify_one();
 
-    m_fd = stdinFds[1];
+    return value;
   }
 
-  Process(const Process &) = delete;
-  Process &operator=(const Process &) = delete;
+private:
+  std::array<T, N> m_slots;
+  std::atomic<std::size_t> m_head;
+  std::atomic<std::size_t> m_tail;
+};
 
-  Process(Process &&other) : m_pid(other.m_pid), m_fd(other.m_fd) {
-    other.m_fd = -1;
+// Buffers waiting to be written, and the position up to which they have been
+class WriteQueue final {
+public:
+  bool empty() const { return m_bufs.empty(); }
+
+  void push(std::vector<std::string> &&bufs) {
+    if (!bufs.empty())
+      m_bufs.push_back(std::move(bufs));
   }
-  Process &operator=(Process &&other) {
-    m_pid = other.m_pid;
-    m_fd = other.m_fd;
 
-    other.m_fd = -1;
+  void clear() {
+    m_bufs.clear();
+    m_buf = m_offset = 0;
+  }
 
-    return *this;
-  };
+  // Points iov to the unwritten data, returns the number of entries used
+  template <std::size_t N> int fill(std::array<iovec, N> &iov) const {
+    int count = 0;
+    bool front = true;
 
-  ~Process() {
-    if (m_fd < 0)
-      return;
+    for (const auto &bufs : m_bufs) {
+      for (auto i = front ? m_buf : 0; i < bufs.size(); ++i) {
+        if (count == static_cast<int>(N))
+          return count;
 
-    close(m_fd);
-    while (::waitpid(m_pid, nullptr, 0) < 0) {
-      if (errno != EINTR)
-        break;
+        std::size_t skip = front && i == m_buf ? m_offset : 0;
+        iov[count++] = {.iov_base = const_cast<char *>(bufs[i].data()) + skip,
+                        .iov_len = bufs[i].size() - skip};
+      }
+      front = false;
     }
-  }
 
-  template <std::size_t N> bool write(const char str[N]) const {
-    return writeAll(m_fd, str, N);
+    return count;
   }
 
-  bool write(const std::string &buf) const { return writeAll(m_fd, buf); }
+  // Skips n written bytes
+  void advance(std::size_t n) {
+    while (!m_bufs.empty()) {
+      const auto &bufs = m_bufs.front();
+
+      if (m_buf == bufs.size()) {
+        m_bufs.pop_front();
+        m_buf = m_offset = 0;
+        continue;
+      }
+
+      std::size_t left = bufs[m_buf].size() - m_offset;
+      if (n < left) {
+        m_offset += n;
+        break;
+      }
+
+      n -= left;
+      ++m_buf;
+      m_offset = 0;
+    }
+  }
 
 private:
-  pid_t m_pid;
-  int m_fd;
+  std::deque<std::vector<std::string>> m_bufs;
+  // Position in the front of the queue
+  std::size_t m_buf = 0;
+  std::size_t m_offset = 0;
 };
 
-struct PlotPriv {
-  PlotPriv(std::string title)
-      : title(std::move(title)), font("Sans"), fontSize(9), activeDataId(-1) {}
+// Writes to a pipe. Large buffers are mapped into the pipe (vmsplice) instead
+// of being copied, and are kept alive until the reader has consumed them.
+// If the pipe is non-blocking, blocking writes wait for it with poll(), which
+// lets them service the reader's output in the meantime (see drainOutput()).
+class PipeWriter final {
+public:
+  static constexpr std::size_t SpliceThreshold = 64 * 1024;
 
-  Process gp;
+  // Reads the available output of the pipe's reader. Returns false once the
+  // output has been closed.
+  using OutputHandler = std::function<bool()>;
 
-  std::string title;
-  std::string font;
-  int fontSize;
+  PipeWriter(int fd = -1) : m_fd(fd), m_written(0), m_nonBlocking(false) {}
 
-  std::optional<Point> position;
-  std::optional<Size> size;
+  // While a blocking write waits for the pipe, output appearing on outFd is
+  // handed to handler. A reader blocked on writing its output would otherwise
+  // never empty the pipe. Not for writes from another thread than the one
+  // consuming the output.
+  void drainOutput(int outFd, OutputHandler handler) {
+    m_outFd = outFd;
+    m_onOutput = std::move(handler);
+  }
 
-  std::array<Range, Axes::Count> ranges;
+  bool write(std::string_view buf) {
+    if (m_nonBlocking || !m_queue.empty())
+      return write(std::string(buf));
 
-  int nextDataId;
-  int activeDataId;
-  std::vector<SeriesPrivPtr> series;
+    release();
 
-  std::string buf;
-  bool dirty;
-  bool rangesDirty;
-};
+    if (!writeAll(m_fd, buf, waiter()))
+      return false;
 
-template <Number First, Number... Ns>
-void appendHelper(std::string &buf, First first, Ns... rest) {
-  fmt::format_to(std::back_inserter(buf), "{}", first);
-  if constexpr (sizeof...(rest) > 0) {
-    buf += ' ';
-    appendHelper(buf, rest...);
+    m_written += buf.size();
+    return true;
   }
-}
 
-template <TupleLikeOfNumbers T, std::size_t I = 0>
-void appendHelper(std::string &buf, const T &t) {
-  using std::get;
-  if constexpr (I < std::tuple_size_v<T>) {
-    fmt::format_to(std::back_inserter(buf), "{}", get<I>(t));
-    if constexpr (I < std::tuple_size_v<T> - 1) {
-      buf += ' ';
-      appendHelper<T, I + 1>(buf, t);
-    } else
-      buf += '\n';
+  bool write(std::string &&buf) {
+    if (m_nonBlocking || !m_queue.empty()) {
+      std::vector<std::string> bufs;
+      bufs.push_back(std::move(buf));
+      return write(std::move(bufs));
+    }
+
+    if (buf.size() < SpliceThreshold)
+      return write(std::string_view(buf));
+
+    release();
+    return splice(std::move(buf));
   }
-}
 
-} // namespace detail
+  bool write(std::vector<std::string> &&bufs) {
+    if (m_nonBlocking)
+      return enqueue(std::move(bufs));
 
-class Series {
-  friend class Plot;
+    // Data queued earlier goes first
+    if (!m_queue.empty()) {
+      m_queue.push(std::move(bufs));
+      return drain();
+    }
 
-public:
-  Series() {}
-  Series(detail::SeriesPrivPtr series) : m_series(series) {}
+    release();
 
-  int dataId() const {
-    assert(m_series);
-    return m_series->data->id;
-  }
+    // Small buffers are gathered, large ones spliced
+    std::size_t first = 0, bytes = 0;
+    for (std::size_t i = 0; i <= bufs.size(); ++i) {
+      if (i < bufs.size() && bufs[i].size() < SpliceThreshold) {
+        bytes += bufs[i].size();
+        continue;
+      }
 
-  Series &title(std::string title) {
-    assert(m_series);
-    if (m_series->title != title) {
-      m_series->title = std::move(title);
-      m_series->dirty = true;
-    }
-    return *this;
-  }
+      if (first < i) {
+        if (!writeAll(m_fd,
+                      std::span<const std::string>(bufs).subspan(
+                          first, i - first),
+                      waiter()))
+          return false;
 
-  const std::string &title() const {
-    assert(m_series);
-    return m_series->title;
-  }
+        m_written += bytes;
+        bytes = 0;
+      }
 
-  Series &with(PlotStyle plotStyle) {
-    assert(m_series);
-    if (m_series->plotStyle != plotStyle) {
-      m_series->plotStyle = plotStyle;
-      m_series->dirty = true;
+      if (i < bufs.size() && !splice(std::move(bufs[i])))
+        return false;
+
+      first = i + 1;
     }
-    return *this;
-  }
 
-  PlotStyle with() const {
-    assert(m_series);
-    return m_series->plotStyle;
+    return true;
   }
 
-  Series &color(std::optional<Color> color) {
-    assert(m_series);
-    if (m_series->color != color) {
-      m_series->color = color;
-      m_series->dirty = true;
-    }
-    return *this;
-  }
+  // Frees spliced buffers which the reader has consumed
+  void release() {
+    if (m_inFlight.empty())
+      return;
 
-  std::optional<Color> color() const {
-    assert(m_series);
-    return m_series->color;
-  }
+    int count = 0;
+    if (::ioctl(m_fd, FIONREAD, &count) < 0)
+      return;
 
-  Series &lineWidth(double lineWidth) {
-    assert(m_series);
-    if (m_series->lineWidth != lineWidth) {
-      m_series->lineWidth = lineWidth;
-      m_series->dirty = true;
-    }
-    return *this;
+    std::uint64_t consumed = m_written - count;
+    while (!m_inFlight.empty() && m_inFlight.front().first <= consumed)
+      m_inFlight.pop_front();
   }
 
-  double lineWidth() const {
-    assert(m_series);
-    return m_series->lineWidth;
-  }
+  bool nonBlocking() const { return m_nonBlocking; }
 
-  Series &pointType(std::optional<PointType> pointType) {
-    assert(m_series);
-    if (m_series->pointType != pointType) {
-      m_series->pointType = pointType;
-      m_series->dirty = true;
-    }
-    return *this;
-  }
+  // In non-blocking mode, writes are queued and written as far as the pipe
+  // accepts them (see flush()). Leaving it writes the rest of the queue.
+  // Requires the pipe to have O_NONBLOCK set.
+  bool nonBlocking(bool nonBlocking) {
+    m_nonBlocking = nonBlocking;
 
-  std::optional<PointType> pointType() const {
-    assert(m_series);
-    return m_series->pointType;
+    // Blocks until the queue is empty
+    return nonBlocking || flush();
   }
 
-  Series &pointSize(double pointSize) {
-    assert(m_series);
-    if (m_series->pointSize != pointSize) {
-      m_series->pointSize = pointSize;
-      m_series->dirty = true;
-    }
-    return *this;
+  // Queues the buffers and writes as much as the pipe accepts, also outside
+  // of non-blocking mode
+  bool enqueue(std::vector<std::string> &&bufs) {
+    m_queue.push(std::move(bufs));
+    return flush();
   }
 
-  double pointSize() const {
-    assert(m_series);
-    return m_series->pointSize;
-  }
+  // Whether queued data is waiting for the pipe to become writable
+  bool pending() const { return !m_queue.empty(); }
 
-  Series &smooth(std::optional<Smooth> smooth) {
-    assert(m_series);
-    if (m_series->smooth != smooth) {
-      m_series->smooth = smooth;
-      m_series->dirty = true;
+  // Writes queued data until the pipe is full. Returns false on error.
+  bool flush() {
+    std::array<iovec, 256> iov;
+
+    while (!m_queue.empty()) {
+      ssize_t ret = ::writev(m_fd, iov.data(), m_queue.fill(iov));
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+      }
+
+      m_written += ret;
+      m_queue.advance(ret);
     }
-    return *this;
-  }
 
-  std::optional<Smooth> smooth() const {
-    assert(m_series);
-    return m_series->smooth;
+    return true;
   }
 
-  Series &axes(AxesPair axes) {
-    assert(m_series);
-    if (m_series->axes != axes) {
-      m_series->axes = axes;
-      m_series->dirty = m_series->axesDirty = true;
+  // Blocks until the queue has been written
+  bool drain() {
+    while (flush() && !m_queue.empty()) {
+      if (!waitWritable())
+        return false;
     }
-    return *this;
-  }
 
-  AxesPair axes() const {
-    assert(m_series);
-    return m_series->axes;
+    return m_queue.empty();
   }
 
-  template <Number... Ns> Series &append(Ns... args) {
-    assert(m_series);
+private:
+  WaitWritable waiter() {
+    return [this] { return waitWritable(); };
+  }
 
-    auto &data = *m_series->data;
+  // Waits for the pipe to accept data, passing on the reader's output
+  bool waitWritable() {
+    pollfd fds[2] = {{.fd = m_fd, .events = POLLOUT, .revents = 0},
+                     {.fd = m_outFd, .events = POLLIN, .revents = 0}};
 
-    detail::appendHelper(data.buf, args...);
+    for (;;) {
+      nfds_t count = m_onOutput ? 2 : 1;
+      if (::poll(fds, count, -1) < 0) {
+        if (errno != EINTR)
+          return false;
+        continue;
+      }
 
-    data.buf += '\n';
-    data.dirty = true;
+      // Includes POLLERR, which the next write reports as EPIPE
+      if (fds[0].revents != 0)
+        return true;
 
-    return *this;
+      // Stop watching the output once the reader has closed it
+      if (count == 2 && fds[1].revents != 0 && !m_onOutput())
+        m_onOutput = nullptr;
+    }
   }
 
-  template <TupleLikeOfNumbers T> Series &append(const T &t) {
-    assert(m_series);
+  bool splice(std::string &&buf) {
+    iovec iov = {.iov_base = buf.data(), .iov_len = buf.size()};
 
-    auto &data = *m_series->data;
+    while (iov.iov_len > 0) {
+      ssize_t ret = ::vmsplice(m_fd, &iov, 1, SPLICE_F_NONBLOCK);
+      if (ret < 0) {
+        if (!retryWrite(waiter()))
+          return false;
+        continue;
+      }
 
-    detail::appendHelper(data.buf, t);
+      iov.iov_base = static_cast<char *>(iov.iov_base) + ret;
+      iov.iov_len -= ret;
+    }
 
-    data.dirty = true;
+    // The pipe references the buffer's pages until they have been read
+    m_written += buf.size();
+    m_inFlight.emplace_back(m_written, std::move(buf));
 
-    return *this;
+    return true;
   }
 
-  template <std::input_iterator I, std::sentinel_for<I> S>
-  Series &append(I first, S last) requires(IsNumberV<typename I::value_type>) {
-    assert(m_series);
-
-    auto &data = *m_series->data;
+  int m_fd;
+  // Number of bytes written so far
+  std::uint64_t m_written;
+  // Spliced buffers with the offset of their end
+  std::deque<std::pair<std::uint64_t, std::string>> m_inFlight;
+  bool m_nonBlocking;
+  WriteQueue m_queue;
+  int m_outFd = -1;
+  OutputHandler m_onOutput;
+};
 
-    if (first != last)
-      fmt::format_to(std::back_inserter(data.buf), "{}", *(first++));
+// Writes buffers to a pipe on a dedicated thread
+class AsyncWriter final {
+public:
+  AsyncWriter(PipeWriter &pipe)
+      : m_pipe(pipe), m_queued(0), m_written(0), m_error(0),
+        m_thread([this] { run(); }) {}
 
-    while (first != last)
-      fmt::format_to(std::back_inserter(data.buf), " {}", *(first++));
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter &operator=(const AsyncWriter &) = delete;
 
-    data.buf += '\n';
-    data.dirty = true;
+  // Writes all queued buffers before returning
+  ~AsyncWriter() {
+    m_queue.push({});
+    m_thread.join();
+  }
 
-    return *this;
+  bool write(std::string buf) {
+    std::vector<std::string> bufs;
+    bufs.push_back(std::move(buf));
+    return write(std::move(bufs));
   }
 
-  template <std::input_iterator I, std::sentinel_for<I> S>
-  Series &
-  append(I first,
-         S last) requires(!IsNumberV<typename I::value_type> &&
-                          IsTupleLikeOfNumbersV<typename I::value_type>) {
-    if (first == last)
-      return *this;
+  bool write(std::vector<std::string> bufs) {
+    if (bufs.empty())
+      return check();
 
-    assert(m_series);
+    ++m_queued;
+    m_queue.push(std::move(bufs));
 
-    auto &data = *m_series->data;
+    return check();
+  }
 
-    std::for_each(first, last,
-                  [&](auto t) { detail::appendHelper(data.buf, t); });
+  // Blocks until all queued buffers have been written
+  bool wait() {
+    for (auto written = m_written.load(std::memory_order_acquire);
+         written != m_queued;
+         written = m_written.load(std::memory_order_acquire))
+      m_written.wait(written, std::memory_order_acquire);
 
-    data.dirty = true;
-    ;
+    return check();
+  }
 
-    return *this;
+  bool idle() const {
+    return m_written.load(std::memory_order_acquire) == m_queued;
   }
 
-  Series &clear() {
-    assert(m_series);
+private:
+  bool check() const {
+    if (int err = m_error.load(std::memory_order_acquire); err != 0) {
+      errno = err;
+      return false;
+    }
 
-    auto &plot = m_series->plot;
-    auto &data = *m_series->data;
+    return true;
+  }
 
-    plot.buf.clear();
-    data.buf.clear();
-    data.dirty = true;
+  void run() {
+    SigPipeBlocker::blockForThread();
 
-    fmt::format_to(std::back_inserter(plot.buf), "undefine $_{}\n", data.id);
+    for (;;) {
+      auto bufs = m_queue.pop();
+      if (bufs.empty())
+        break;
 
-    if (!plot.gp.write(plot.buf))
-      throw std::system_error(errno, std::generic_category(),
-                              "Series: clear: write");
+      // Discard everything after the first error
+      if (m_error.load(std::memory_order_relaxed) == 0 &&
+          !m_pipe.write(std::move(bufs)))
+        m_error.store(errno, std::memory_order_release);
 
-    return *this;
+      m_written.fetch_add(1, std::memory_order_release);
+      m_written.notify_one();
+    }
   }
 
-  operator bool() const { return (bool)m_series; }
+  static constexpr std::size_t QueueSize = 64;
 
-private:
-  detail::SeriesPrivPtr m_series;
+  PipeWriter &m_pipe;
+  SpscQueue<std::vector<std::string>, QueueSize> m_queue;
+  // Number of buffers queued (producer only)
+  std::size_t m_queued;
+  std::atomic<std::size_t> m_written;
+  std::atomic<int> m_error;
+  std::thread m_thread;
 };
 
-class Plot {
-public:
-  Plot() {}
+#if GNUPLOTXX_HAS_IO_URING
 
-  Plot(std::string title)
-      : m_plot(std::make_shared<detail::PlotPriv>(std::move(title))) {}
+// Minimal io_uring (set up through raw system calls) which writes buffers to
+// pipes. Every pipe has at most one write in flight, so its data stays in
+// order. Writes beyond the completion queue's capacity wait for earlier ones
+// to complete. Not thread-safe.
+class Uring final {
+public:
+  Uring(unsigned entries) : m_fd(-1), m_toSubmit(0), m_inFlight(0) {
+    io_uring_params params = {};
 
-  Plot(detail::PlotPrivPtr plot) : m_plot(plot) {}
+    int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0)
+      return;
 
-  Plot &title(std::string title) {
-    assert(m_plot);
-    if (m_plot->title != title) {
-      m_plot->title = std::move(title);
-      m_plot->dirty = true;
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap)
+      m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+    m_sqRing = map(fd, m_sqRingSize, IORING_OFF_SQ_RING);
+    m_cqRing =
+        singleMmap ? m_sqRing : map(fd, m_cqRingSize, IORING_OFF_CQ_RING);
+    void *sqes = map(fd, m_sqesSize, IORING_OFF_SQES);
+
+    if (m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED ||
+        sqes == MAP_FAILED) {
+      unmap(m_sqRing, m_sqRingSize);
+      if (!singleMmap)
+        unmap(m_cqRing, m_cqRingSize);
+      unmap(sqes, m_sqesSize);
+      close(fd);
+      return;
     }
-    return *this;
-  }
 
-  const std::string &title() const {
-    assert(m_plot);
-    return m_plot->title;
+    m_sqHead = at<unsigned>(m_sqRing, params.sq_off.head);
+    m_sqTail = at<unsigned>(m_sqRing, params.sq_off.tail);
+    m_sqMask = *at<unsigned>(m_sqRing, params.sq_off.ring_mask);
+    m_sqEntries = *at<unsigned>(m_sqRing, params.sq_off.ring_entries);
+    m_sqArray = at<unsigned>(m_sqRing, params.sq_off.array);
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    m_cqHead = at<unsigned>(m_cqRing, params.cq_off.head);
+    m_cqTail = at<unsigned>(m_cqRing, params.cq_off.tail);
+    m_cqMask = *at<unsigned>(m_cqRing, params.cq_off.ring_mask);
+    m_cqEntries = params.cq_entries;
+    m_cqes = at<io_uring_cqe>(m_cqRing, params.cq_off.cqes);
+
+    m_fd = fd;
   }
 
-  Plot &font(std::string font) {
-    assert(m_plot);
-    if (m_plot->font != font) {
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  ~Uring() {
+    if (m_fd < 0)
+      return;
+
+    unmap(m_sqes, m_sqesSize);
+    if (m_cqRing != m_sqRing)
+      unmap(m_cqRing, m_cqRingSize);
+    unmap(m_sqRing, m_sqRingSize);
+    close(m_fd);
+  }
+
+  // Whether the kernel supports io_uring (and it is not disabled)
+  bool available() const { return m_fd >= 0; }
+
+  // Readable while there are completions to handle
+  int fd() const { return m_fd; }
+
+  // Queues the buffers, to be written after all buffers queued before
+  bool write(int fd, std::vector<std::string> &&bufs) {
+    auto &channel = m_channels[fd];
+
+    if (channel.error != 0) {
+      errno = channel.error;
+      return false;
+    }
+
+    channel.queue.push(std::move(bufs));
+
+    return channel.inFlight || channel.deferred || channel.queue.empty() ||
+           prepare(fd, channel);
+  }
+
+  // Submits all prepared writes, after handling completed ones
+  bool submit() {
+    complete();
+    return m_toSubmit == 0 || enter(0);
+  }
+
+  // Like submit(), but waits for at least one write to complete
+  bool reap() {
+    if (m_inFlight == 0)
+      return submit();
+
+    if (!enter(1))
+      return false;
+
+    complete();
+    return submit();
+  }
+
+  // Blocks until all buffers queued for the pipe have been written. Output
+  // appearing on outFd meanwhile is handed to onOutput, as PipeWriter does
+  // (see PipeWriter::drainOutput()).
+  bool wait(int fd, int outFd = -1, PipeWriter::OutputHandler onOutput = {}) {
+    auto it = m_channels.find(fd);
+    if (it == m_channels.end())
+      return true;
+
+    auto &channel = it->second;
+    while (channel.inFlight || channel.deferred) {
+      if (!onOutput) {
+        if (!enter(1))
+          return false;
+        complete();
+        continue;
+      }
+
+      // Completions may start deferred writes, so submit after reaping them
+      complete();
+      if (!channel.inFlight && !channel.deferred)
+        break;
+      if (m_toSubmit > 0 && !enter(0))
+        return false;
+
+      // The ring's FD is readable while completions are waiting
+      pollfd fds[2] = {{.fd = m_fd, .events = POLLIN, .revents = 0},
+                       {.fd = outFd, .events = POLLIN, .revents = 0}};
+      if (::poll(fds, 2, -1) < 0) {
+        if (errno != EINTR)
+          return false;
+        continue;
+      }
+
+      // Stop watching the output once the reader has closed it
+      if (fds[1].revents != 0 && !onOutput())
+        onOutput = nullptr;
+    }
+
+    if (channel.error != 0) {
+      errno = channel.error;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool busy(int fd) const {
+    auto it = m_channels.find(fd);
+    return it != m_channels.end() &&
+           (it->second.inFlight || it->second.deferred);
+  }
+
+  // Waits for the pipe's writes (see wait()) and forgets it
+  void remove(int fd, int outFd = -1,
+              PipeWriter::OutputHandler onOutput = {}) {
+    wait(fd, outFd, std::move(onOutput));
+    m_channels.erase(fd);
+  }
+
+private:
+  struct Channel {
+    WriteQueue queue;
+    std::array<iovec, 64> iov;
+    bool inFlight = false;
+    // Waiting for room in the completion queue
+    bool deferred = false;
+    int error = 0;
+  };
+
+  static void *map(int fd, std::size_t size, off_t offset) {
+    return ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, offset);
+  }
+
+  static void unmap(void *addr, std::size_t size) {
+    if (addr != MAP_FAILED)
+      ::munmap(addr, size);
+  }
+
+  template <typename T> static T *at(void *base, unsigned offset) {
+    return reinterpret_cast<T *>(static_cast<std::byte *>(base) + offset);
+  }
+
+  bool enter(unsigned minComplete) {
+    unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    // Submission may write inline, to a pipe whose reader has exited
+    SigPipeBlocker blocker;
+
+    long ret;
+    while ((ret = ::syscall(__NR_io_uring_enter, m_fd, m_toSubmit, minComplete,
+                            flags, nullptr, 0)) < 0) {
+      if (errno != EINTR)
+        return false;
+    }
+
+    m_toSubmit -= static_cast<unsigned>(ret);
+    return true;
+  }
+
+  // Prepares a write of the channel's queue
+  bool prepare(int fd, Channel &channel) {
+    // More writes in flight than completions fit in the queue would overflow
+    // it, so defer the write until one has completed
+    if (m_inFlight == m_cqEntries) {
+      channel.deferred = true;
+      m_deferred.push_back(fd);
+      return true;
+    }
+
+    unsigned tail = *m_sqTail;
+
+    // Make room by submitting what was prepared so far
+    if (tail - std::atomic_ref(*m_sqHead).load(std::memory_order_acquire) ==
+            m_sqEntries &&
+        !enter(0))
+      return false;
+
+    int count = channel.queue.fill(channel.iov);
+
+    unsigned index = tail & m_sqMask;
+    m_sqes[index] = {};
+    m_sqes[index].opcode = IORING_OP_WRITEV;
+    m_sqes[index].fd = fd;
+    m_sqes[index].addr = reinterpret_cast<std::uint64_t>(channel.iov.data());
+    m_sqes[index].len = count;
+    m_sqes[index].user_data = static_cast<std::uint64_t>(fd);
+    m_sqArray[index] = index;
+
+    std::atomic_ref(*m_sqTail).store(tail + 1, std::memory_order_release);
+
+    ++m_toSubmit;
+    ++m_inFlight;
+    channel.inFlight = true;
+
+    return true;
+  }
+
+  // Handles completed writes and prepares the next write of each pipe
+  void complete() {
+    unsigned head = *m_cqHead;
+    unsigned tail = std::atomic_ref(*m_cqTail).load(std::memory_order_acquire);
+
+    for (; head != tail; ++head) {
+      const auto &cqe = m_cqes[head & m_cqMask];
+
+      int fd = static_cast<int>(cqe.user_data);
+      auto it = m_channels.find(fd);
+      if (it == m_channels.end())
+        continue;
+
+      auto &channel = it->second;
+      channel.inFlight = false;
+      --m_inFlight;
+
+      // Discard everything after the first error
+      if (cqe.res < 0) {
+        channel.error = -cqe.res;
+        channel.queue.clear();
+        continue;
+      }
+
+      channel.queue.advance(static_cast<std::size_t>(cqe.res));
+
+      if (!channel.queue.empty() && !prepare(fd, channel))
+        channel.error = errno;
+    }
+
+    std::atomic_ref(*m_cqHead).store(head, std::memory_order_release);
+
+    while (!m_deferred.empty() && m_inFlight < m_cqEntries) {
+      int fd = m_deferred.front();
+      m_deferred.pop_front();
+
+      auto it = m_channels.find(fd);
+      if (it == m_channels.end())
+        continue;
+
+      auto &channel = it->second;
+      channel.deferred = false;
+      if (channel.error == 0 && !channel.queue.empty() &&
+          !prepare(fd, channel))
+        channel.error = errno;
+    }
+  }
+
+  int m_fd;
+  // Prepared, but not yet submitted writes
+  unsigned m_toSubmit;
+  unsigned m_inFlight;
+
+  void *m_sqRing;
+  std::size_t m_sqRingSize;
+  void *m_cqRing;
+  std::size_t m_cqRingSize;
+  io_uring_sqe *m_sqes;
+  std::size_t m_sqesSize;
+
+  unsigned *m_sqHead;
+  unsigned *m_sqTail;
+  unsigned m_sqMask;
+  unsigned m_sqEntries;
+  unsigned *m_sqArray;
+
+  unsigned *m_cqHead;
+  unsigned *m_cqTail;
+  unsigned m_cqMask;
+  unsigned m_cqEntries;
+  io_uring_cqe *m_cqes;
+
+  std::unordered_map<int, Channel> m_channels;
+  // Pipes whose next write waits for room in the completion queue
+  std::deque<int> m_deferred;
+};
+
+#else
+
+// Stands in for io_uring where it is not supported, never available
+class Uring final {
+public:
+  Uring(unsigned) {}
+
+  bool available() const { return false; }
+  int fd() const { return -1; }
+
+  bool write(int, std::vector<std::string> &&) {
+    errno = ENOSYS;
+    return false;
+  }
+
+  bool submit() { return true; }
+  bool reap() { return true; }
+  bool wait(int, int = -1, PipeWriter::OutputHandler = {}) { return true; }
+  bool busy(int) const { return false; }
+  void remove(int, int = -1, PipeWriter::OutputHandler = {}) {}
+};
+
+#endif
+
+} // namespace detail
+
+// Destination of the command and data stream generated by a Plot
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  virtual bool write(std::string_view buf) = 0;
+
+  // Allows implementations to take ownership of the buffer
+  virtual bool write(std::string &&buf) { return write(std::string_view(buf)); }
+
+  // Writes several buffers in order, ideally with a single system call
+  virtual bool write(std::vector<std::string> &&bufs) {
+    for (auto &buf : bufs) {
+      if (!write(std::move(buf)))
+        return false;
+    }
+
+    return true;
+  }
+
+  // Writes what the receiver accepts without blocking and queues the rest,
+  // regardless of nonBlocking(); see pump() and pending(). Falls back to
+  // write().
+  virtual bool enqueue(std::vector<std::string> &&bufs) {
+    return write(std::move(bufs));
+  }
+
+  virtual bool async() const { return false; }
+
+  // Returns false if asynchronous writes are not supported
+  virtual bool async(bool async) { return !async; }
+
+  // Blocks until all data has been delivered
+  virtual bool wait() { return true; }
+
+  virtual bool nonBlocking() const { return false; }
+
+  // Returns false if non-blocking writes are not supported
+  virtual bool nonBlocking(bool nonBlocking) { return !nonBlocking; }
+
+  // File descriptors an event loop should watch, with the events of interest
+  virtual std::vector<pollfd> interest() const { return {}; }
+
+  // Writes queued data as far as possible without blocking. Returns false on
+  // error.
+  virtual bool pump() { return true; }
+
+  // Whether written data is still queued on our side (see pump())
+  virtual bool pending() const { return false; }
+
+  virtual std::size_t bufferSize() const { return 0; }
+
+  // Returns false if the buffer size cannot be changed
+  virtual bool bufferSize([[maybe_unused]] std::size_t size) { return false; }
+
+  // Whether the receiver has not yet consumed all data written so far
+  virtual bool busy() const { return false; }
+
+  // Whether the receiver reports rendered frames (see acked())
+  virtual bool acknowledges() const { return false; }
+
+  // Reads the receiver's output, waiting up to timeout milliseconds (-1:
+  // forever) for it to become available. Returns false on error.
+  virtual bool poll([[maybe_unused]] int timeout) { return true; }
+
+  // Sequence number of the last acknowledged frame of the given window
+  virtual std::uint64_t acked([[maybe_unused]] int window) const { return 0; }
+
+  virtual std::chrono::steady_clock::time_point
+  ackTime([[maybe_unused]] int window) const {
+    return {};
+  }
+
+  // Whether the receiver has gone away
+  virtual bool eof() const { return false; }
+
+  virtual std::vector<std::string> takeMessages() { return {}; }
+
+  // Replaces a receiver which has gone away. Returns false if not supported.
+  virtual bool restart() { return false; }
+
+  // Incremented by every restart (the receiver has lost all state)
+  virtual std::uint64_t generation() const { return 0; }
+
+  // Plots sharing a transport draw into separate windows and share the data
+  // block namespace
+  int allocateWindow() {
+    ++m_openWindows;
+    return m_nextWindow++;
+  }
+
+  int allocateDataId() { return m_nextDataId++; }
+
+  // Gives up a window. The commands releasing it in the receiver are only
+  // written while other windows remain open; after the last one, the receiver
+  // is about to go away or be reset anyway. Returns false on error.
+  bool releaseWindow(std::string_view commands) {
+    if (--m_openWindows == 0 || commands.empty())
+      return true;
+
+    switchTo(nullptr);
+    return write(commands);
+  }
+
+  // Records which plot's settings gnuplot currently holds. Returns true if
+  // that was another plot.
+  bool switchTo(const void *plot) {
+    return std::exchange(m_currentPlot, plot) != plot;
+  }
+
+protected:
+  void resetState() {
+    m_nextWindow = 0;
+    m_nextDataId = 0;
+    m_currentPlot = nullptr;
+  }
+
+private:
+  int m_nextWindow = 0;
+  int m_openWindows = 0;
+  int m_nextDataId = 0;
+  const void *m_currentPlot = nullptr;
+};
+
+class ProcessPool;
+
+namespace detail {
+
+// Pipes the stream into a gnuplot child process
+class Process final : public Transport {
+  friend class gnuplotxx::ProcessPool;
+
+public:
+  static constexpr std::string_view AckPrefix = "__gpxx_ack ";
+  static constexpr std::string_view ResetMarker = "__gpxx_reset";
+
+  // gnuplot is started on the first write
+  Process()
+      : m_pid(-1), m_fd(-1), m_outFd(-1), m_epollFd(-1),
+        m_pipeSize(DefaultPipeSize), m_async(false), m_nonBlocking(false),
+        m_resetting(false), m_eof(false), m_generation(0) {}
+
+  Process(const Process &) = delete;
+  Process &operator=(const Process &) = delete;
+
+  ~Process() {
+    if (m_fd >= 0)
+      stop();
+  }
+
+  bool write(std::string_view buf) override {
+    if (m_fd < 0)
+      start();
+
+    if (m_writer)
+      return m_writer->write(std::string(buf));
+
+    if (m_ring)
+      return write(std::string(buf));
+
+    SigPipeBlocker blocker;
+    return m_pipe.write(buf);
+  }
+
+  // Avoids a copy in asynchronous mode
+  bool write(std::string &&buf) override {
+    if (m_fd < 0)
+      start();
+
+    if (m_writer)
+      return m_writer->write(std::move(buf));
+
+    if (m_ring) {
+      std::vector<std::string> bufs;
+      bufs.push_back(std::move(buf));
+      return m_ring->write(m_fd, std::move(bufs));
+    }
+
+    SigPipeBlocker blocker;
+    return m_pipe.write(std::move(buf));
+  }
+
+  bool write(std::vector<std::string> &&bufs) override {
+    if (m_fd < 0)
+      start();
+
+    if (m_writer)
+      return m_writer->write(std::move(bufs));
+
+    if (m_ring)
+      return m_ring->write(m_fd, std::move(bufs));
+
+    SigPipeBlocker blocker;
+    return m_pipe.write(std::move(bufs));
+  }
+
+  // The writer thread and io_uring do not block the caller anyway
+  bool enqueue(std::vector<std::string> &&bufs) override {
+    if (m_fd < 0)
+      start();
+
+    if (m_writer || m_ring)
+      return write(std::move(bufs));
+
+    SigPipeBlocker blocker;
+    return m_pipe.enqueue(std::move(bufs));
+  }
+
+  bool async() const override { return m_async; }
+
+  // In asynchronous mode, writes return immediately and the data is written
+  // to gnuplot on a dedicated thread.
+  bool async(bool async) override {
+    // Writes through an io_uring never block anyway
+    if (m_ring || m_nonBlocking)
+      return !async;
+
+    m_async = async;
+
+    if (m_fd < 0)
+      return true;
+
+    if (async && !m_writer) {
+      // The writer thread must not consume the output
+      m_pipe.drainOutput(-1, nullptr);
+      m_writer = std::make_unique<AsyncWriter>(m_pipe);
+    } else if (!async && m_writer) {
+      waitWriter();
+      m_writer.reset();
+      drainOutput();
+    }
+
+    return true;
+  }
+
+  bool nonBlocking() const override { return m_nonBlocking; }
+
+  bool nonBlocking(bool nonBlocking) override {
+    if (m_ring || m_async)
+      return !nonBlocking;
+
+    m_nonBlocking = nonBlocking;
+
+    return m_fd < 0 || m_pipe.nonBlocking(nonBlocking);
+  }
+
+  std::vector<pollfd> interest() const override {
+    if (m_fd < 0 || m_eof)
+      return {};
+
+    std::vector<pollfd> fds = {{.fd = m_outFd, .events = POLLIN, .revents = 0}};
+    if (m_pipe.pending())
+      fds.push_back({.fd = m_fd, .events = POLLOUT, .revents = 0});
+    if (m_ring)
+      fds.push_back({.fd = m_ring->fd(), .events = POLLIN, .revents = 0});
+
+    return fds;
+  }
+
+  bool pump() override {
+    SigPipeBlocker blocker;
+    return m_fd < 0 || m_pipe.flush();
+  }
+
+  // Queued writes, both non-blocking and io_uring ones (the writer thread has
+  // no file descriptor to wait for)
+  bool pending() const override {
+    return m_pipe.pending() || (m_ring && m_ring->busy(m_fd));
+  }
+
+  std::size_t bufferSize() const override { return m_pipeSize; }
+
+  // Capacity of gnuplot's stdin pipe. Larger pipes let big updates through
+  // with fewer round trips. Sizes above the system limit
+  // (/proc/sys/fs/pipe-max-size) are reduced to the largest possible size.
+  bool bufferSize(std::size_t size) override {
+    m_pipeSize = size;
+
+    if (m_fd >= 0)
+      resizePipe();
+
+    return true;
+  }
+
+  // Writes are queued in the given io_uring and submitted in batches. Must be
+  // set before gnuplot is started.
+  void ring(std::shared_ptr<Uring> ring) {
+    assert(m_fd < 0);
+    m_ring = std::move(ring);
+  }
+
+  // Blocks until all data has been written to gnuplot
+  bool wait() override {
+    if (m_ring)
+      return m_fd < 0 ||
+             (m_ring->submit() && m_ring->wait(m_fd, m_outFd, outputHandler()));
+
+    if (m_pipe.pending()) {
+      SigPipeBlocker blocker;
+      return m_pipe.drain();
+    }
+
+    return !m_writer || waitWriter();
+  }
+
+  // Whether gnuplot has not yet consumed all data written so far
+  bool busy() const override {
+    if (m_writer && !m_writer->idle())
+      return true;
+
+    if (m_ring && m_ring->busy(m_fd))
+      return true;
+
+    if (m_pipe.pending())
+      return true;
+
+    int count = 0;
+    return m_fd >= 0 && ::ioctl(m_fd, FIONREAD, &count) == 0 && count > 0;
+  }
+
+  bool acknowledges() const override { return true; }
+
+  // Reads gnuplot's output, waiting up to timeout milliseconds (-1: forever)
+  // for it to become available. Returns false on error.
+  bool poll(int timeout) override {
+    if (m_eof || m_fd < 0)
+      return true;
+
+    // Completed writes are handled, queued ones submitted
+    if (m_ring && !m_ring->submit())
+      return false;
+
+    if (!m_writer)
+      m_pipe.release();
+
+    epoll_event events[1];
+    int ret;
+
+    while ((ret = ::epoll_wait(m_epollFd, events, 1, timeout)) < 0) {
+      if (errno != EINTR)
+        return false;
+    }
+
+    return ret == 0 || readOutput();
+  }
+
+  // Sequence number of the last acknowledgement received
+  std::uint64_t acked(int window) const override {
+    auto it = m_acks.find(window);
+    return it != m_acks.end() ? it->second.seq : 0;
+  }
+
+  std::chrono::steady_clock::time_point ackTime(int window) const override {
+    auto it = m_acks.find(window);
+    return it != m_acks.end() ? it->second.time
+                              : std::chrono::steady_clock::time_point();
+  }
+
+  // Whether gnuplot closed its output (i.e. exited)
+  bool eof() const override { return m_eof; }
+
+  std::vector<std::string> takeMessages() override {
+    std::vector<std::string> messages(m_messages.begin(), m_messages.end());
+    m_messages.clear();
+    return messages;
+  }
+
+  // Replaces gnuplot after it has exited or closed its input, e.g. because it
+  // crashed or ran out of memory. Everything gnuplot held is lost and has to
+  // be sent again (see generation()). Throws if gnuplot could not be executed.
+  bool restart() override {
+    if (m_fd < 0)
+      return true;
+
+    // A process which stopped reading is of no further use
+    ::kill(m_pid, SIGKILL);
+    stop();
+
+    m_output.clear();
+    m_resetting = false;
+    m_eof = false;
+    ++m_generation;
+    switchTo(nullptr);
+
+    start();
+
+    return true;
+  }
+
+  std::uint64_t generation() const override { return m_generation; }
+
+private:
+  struct SpawnArgs {
+    int stdinFd, outFd, execErrFd;
+    sigset_t sigmask;
+  };
+
+  // Runs in the child, on its own stack but sharing the parent's memory until
+  // exec, so only raw system calls may be used
+  static int spawnChild(void *arg) {
+    const auto &args = *static_cast<const SpawnArgs *>(arg);
+
+    auto raiseError = [&args](int err, std::string_view msg) {
+      writeAll(args.execErrFd, &err, sizeof(err));
+      writeAll(args.execErrFd, msg.data(), msg.size());
+      ::_exit(127);
+    };
+
+    // Handlers installed by the parent must not run in the shared memory
+    struct sigaction action = {};
+    for (int sig = 1; sig < NSIG; ++sig) {
+      if (::sigaction(sig, nullptr, &action) == 0 &&
+          action.sa_handler != SIG_IGN && action.sa_handler != SIG_DFL) {
+        action.sa_handler = SIG_DFL;
+        ::sigaction(sig, &action, nullptr);
+      }
+    }
+
+    // No PR_SET_PDEATHSIG: it fires when the spawning thread exits, and
+    // gnuplot is started by whichever thread writes first. gnuplot exits on
+    // its own when it reads EOF, i.e. once we closed stdin or died.
+
+    // dup2() clears FD_CLOEXEC, unless both FDs are the same
+    auto redirect = [](int fd, int target) {
+      if (fd == target)
+        return ::fcntl(fd, F_SETFD, 0) == 0;
+      return dup2(fd, target);
+    };
+
+    if (!redirect(args.stdinFd, STDIN_FILENO))
+      raiseError(errno, "child: dup2 (stdin)");
+
+    // gnuplot's output (error messages and acknowledgements) is read back
+    if (!redirect(args.outFd, STDOUT_FILENO))
+      raiseError(errno, "child: dup2 (stdout)");
+    if (!redirect(args.outFd, STDERR_FILENO))
+      raiseError(errno, "child: dup2 (stderr)");
+
+    ::pthread_sigmask(SIG_SETMASK, &args.sigmask, nullptr);
+
+    ::execlp("gnuplot", "gnuplot", "-d", (char *)NULL);
+
+    raiseError(errno, "execlp");
+    return 0;
+  }
+
+  // Launches gnuplot like posix_spawn() does: the child shares our memory and
+  // we are suspended until it has called exec, so the cost does not depend on
+  // the size of our address space (as fork() copying the page tables would).
+  void spawn(int stdinFd, int outFd, int execErrFd) {
+    constexpr std::size_t stackSize = 64 * 1024;
+
+    void *stack = ::mmap(nullptr, stackSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED)
+      throw std::system_error(errno, std::generic_category(), "Process: mmap");
+
+    SpawnArgs args = {stdinFd, outFd, execErrFd, {}};
+
+    // No signals may be delivered to the child before its handlers are reset
+    sigset_t all;
+    ::sigfillset(&all);
+    ::pthread_sigmask(SIG_SETMASK, &all, &args.sigmask);
+
+    m_pid = ::clone(spawnChild, static_cast<std::byte *>(stack) + stackSize,
+                    CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+    int err = errno;
+
+    ::pthread_sigmask(SIG_SETMASK, &args.sigmask, nullptr);
+    ::munmap(stack, stackSize);
+
+    if (m_pid < 0)
+      throw std::system_error(err, std::generic_category(), "Process: clone");
+  }
+
+  // Spawns gnuplot, throws if it could not be executed
+  void start() {
+    int stdinFds[2], outFds[2], execErrFds[2];
+
+    // All FDs are closed on exec, except for those redirected by the child
+    if (::pipe2(stdinFds, O_CLOEXEC) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Process: pipe (stdin FDs)");
+    if (::pipe2(outFds, O_CLOEXEC) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Process: pipe (output FDs)");
+    if (::pipe2(execErrFds, O_CLOEXEC) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Process: pipe (exec error FDs)");
+
+    spawn(stdinFds[0], outFds[1], execErrFds[1]);
+
+    close(stdinFds[0]);
+    close(outFds[1]);
+    close(execErrFds[1]);
+
+    if ((m_epollFd = ::epoll_create1(EPOLL_CLOEXEC)) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Process: epoll_create1");
+
+    epoll_event events[1] = {{.events = EPOLLIN, .data = {}}};
+
+    if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, execErrFds[0], &events[0]) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Process: epoll_ctl");
+
+    while (::epoll_wait(m_epollFd, events, 1, -1) < 0) {
+      if (errno != EINTR)
+        throw std::system_error(errno, std::generic_category(),
+                                "Process: epoll_wait");
+    }
+
+    int err, ret;
+    if ((ret = read(execErrFds[0], &err, sizeof(err))) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Process: read (exec error FD) error code");
+
+    if (ret > 0) {
+      char childMsg[128];
+      if ((ret = read(execErrFds[0], childMsg, sizeof(childMsg))) < 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "Process: read (exec error FD) error message");
+
+      std::string msg = "Process: failed to exec gnuplot: ";
+      msg.append(childMsg, ret);
+
+      // Leave the process unstarted, so the next write tries again
+      close(stdinFds[1]);
+      close(outFds[0]);
+      close(execErrFds[0]);
+      close(m_epollFd);
+      m_epollFd = -1;
+      ::waitpid(m_pid, nullptr, 0);
+      m_pid = -1;
+
+      throw std::system_error(err, std::generic_category(), msg);
+    }
+
+    ::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, execErrFds[0], nullptr);
+    close(execErrFds[0]);
+
+    if (::fcntl(outFds[0], F_SETFL, O_NONBLOCK) < 0)
+      throw std::system_error(errno, std::generic_category(), "Process: fcntl");
+
+    events[0] = {.events = EPOLLIN, .data = {}};
+
+    if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, outFds[0], &events[0]) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Process: epoll_ctl");
+
+    // Wakes up poll() to continue writes which are waiting for completions
+    if (m_ring &&
+        ::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_ring->fd(), &events[0]) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Process: epoll_ctl");
+
+    // Blocking writes wait with poll(), so that they can read gnuplot's output
+    // meanwhile. io_uring would fail writes to a non-blocking pipe instead of
+    // waiting for it.
+    if (!m_ring && ::fcntl(stdinFds[1], F_SETFL, O_NONBLOCK) < 0)
+      throw std::system_error(errno, std::generic_category(), "Process: fcntl");
+
+    m_fd = stdinFds[1];
+    m_outFd = outFds[0];
+    m_pipe = PipeWriter(m_fd);
+    m_pipe.nonBlocking(m_nonBlocking);
+
+    resizePipe();
+
+    if (m_async)
+      m_writer = std::make_unique<AsyncWriter>(m_pipe);
+    else
+      drainOutput();
+  }
+
+  // Returns gnuplot to its initial state, so it can be reused by another plot
+  // (see ProcessPool). Acknowledgements and messages still in flight are
+  // discarded. Never blocks: returns false if gnuplot is gone or has not yet
+  // taken all data written so far, in which case it should be discarded.
+  bool reset() {
+    if (m_fd < 0)
+      return true;
+
+    if (m_ring || (m_writer && !m_writer->idle()))
+      return false;
+
+    async(false);
+
+    if (!poll(0) || m_eof || m_pipe.pending())
+      return false;
+
+    m_acks.clear();
+    m_messages.clear();
+    m_resetting = true;
+    resetState();
+
+    // Queue the commands, and give up if the pipe cannot take them right away
+    SigPipeBlocker blocker;
+    m_nonBlocking = false;
+    m_pipe.nonBlocking(true);
+
+    if (!m_pipe.write(fmt::format("reset\nundefine $*\nset terminal qt "
+                                  "close\nprint \"{}\"\n",
+                                  ResetMarker)) ||
+        m_pipe.pending())
+      return false;
+
+    return m_pipe.nonBlocking(false);
+  }
+
+  // Closes the pipes (which makes gnuplot exit) and reaps the process
+  void stop() {
+    if (m_writer) {
+      waitWriter();
+      m_writer.reset();
+    }
+
+    if (m_ring)
+      m_ring->remove(m_fd, m_outFd, outputHandler());
+    m_pipe = PipeWriter();
+
+    close(m_fd);
+    close(m_outFd);
+    close(m_epollFd);
+    while (::waitpid(m_pid, nullptr, 0) < 0) {
+      if (errno != EINTR)
+        break;
+    }
+
+    m_pid = -1;
+    m_fd = m_outFd = m_epollFd = -1;
+  }
+
+  // Reads whatever output gnuplot has produced. Returns false on error.
+  bool readOutput() {
+    char buf[4096];
+    ssize_t ret;
+    while ((ret = read(m_outFd, buf, sizeof(buf))) > 0)
+      m_output.append(buf, ret);
+
+    if (ret == 0)
+      m_eof = true;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK)
+      return false;
+
+    std::size_t begin = 0, end;
+    while ((end = m_output.find('\n', begin)) != std::string::npos) {
+      parseLine(std::string_view(m_output).substr(begin, end - begin));
+      begin = end + 1;
+    }
+    m_output.erase(0, begin);
+
+    return true;
+  }
+
+  // Blocks until the writer thread has written its queue. gnuplot might block
+  // on its output until we read it, so the output is read meanwhile.
+  bool waitWriter() {
+    while (!m_writer->idle() && !m_eof) {
+      if (!poll(WriterPollInterval))
+        break;
+    }
+
+    return m_writer->wait();
+  }
+
+  // Reads gnuplot's output while a write waits, returns false once gnuplot
+  // has closed it
+  PipeWriter::OutputHandler outputHandler() {
+    return [this] { return readOutput() && !m_eof; };
+  }
+
+  // Lets blocking writes read gnuplot's output while the pipe is full
+  void drainOutput() { m_pipe.drainOutput(m_outFd, outputHandler()); }
+
+  void resizePipe() {
+    if (::fcntl(m_fd, F_SETPIPE_SZ, static_cast<int>(m_pipeSize)) >= 0 ||
+        errno != EPERM)
+      return;
+
+    // Unprivileged processes are limited to pipe-max-size
+    int fd = open("/proc/sys/fs/pipe-max-size", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return;
+
+    char buf[32];
+    ssize_t ret = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    int maxSize = 0;
+    if (ret > 0 && std::from_chars(buf, buf + ret, maxSize).ec == std::errc() &&
+        static_cast<std::size_t>(maxSize) < m_pipeSize)
+      ::fcntl(m_fd, F_SETPIPE_SZ, maxSize);
+  }
+
+  void parseLine(std::string_view line) {
+    if (m_resetting) {
+      m_resetting = line != ResetMarker;
+      return;
+    }
+
+    // <window> <sequence number>
+    if (line.starts_with(AckPrefix)) {
+      auto args = line.substr(AckPrefix.size());
+      const char *end = args.data() + args.size();
+      int window = 0;
+      std::uint64_t seq = 0;
+
+      auto [p, ec] = std::from_chars(args.data(), end, window);
+      if (ec == std::errc() && p != end && *p == ' ' &&
+          std::from_chars(p + 1, end, seq).ec == std::errc()) {
+        auto &ack = m_acks[window];
+        ack.seq = std::max(ack.seq, seq);
+        ack.time = std::chrono::steady_clock::now();
+        return;
+      }
+    }
+
+    if (m_messages.size() == MaxMessages)
+      m_messages.pop_front();
+
+    m_messages.emplace_back(line);
+  }
+
+  static constexpr std::size_t MaxMessages = 256;
+  // Milliseconds between reads of the output while waiting for the writer
+  // thread
+  static constexpr int WriterPollInterval = 1;
+  static constexpr std::size_t DefaultPipeSize = 1024 * 1024;
+
+  pid_t m_pid;
+  int m_fd;
+  int m_outFd;
+  int m_epollFd;
+  std::size_t m_pipeSize;
+  PipeWriter m_pipe;
+  std::shared_ptr<Uring> m_ring;
+  bool m_async;
+  bool m_nonBlocking;
+  std::unique_ptr<AsyncWriter> m_writer;
+
+  // Incomplete output line
+  std::string m_output;
+  std::deque<std::string> m_messages;
+
+  struct Ack {
+    std::uint64_t seq = 0;
+    std::chrono::steady_clock::time_point time;
+  };
+
+  // Last acknowledgement per window
+  std::unordered_map<int, Ack> m_acks;
+
+  // Whether output preceding a reset is still being discarded
+  bool m_resetting;
+  bool m_eof;
+  // Number of restarts
+  std::uint64_t m_generation;
+};
+
+} // namespace detail
+
+// Writes the stream to a file, e.g. to replay it later with gnuplot
+class FileTransport final : public Transport {
+public:
+  FileTransport(const std::string &path) {
+    if ((m_fd = detail::open(path.c_str(),
+                             O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) <
+        0)
+      throw std::system_error(errno, std::generic_category(),
+                              "FileTransport: open");
+  }
+
+  FileTransport(const FileTransport &) = delete;
+  FileTransport &operator=(const FileTransport &) = delete;
+
+  ~FileTransport() { detail::close(m_fd); }
+
+  using Transport::write;
+
+  bool write(std::string_view buf) override {
+    return detail::writeAll(m_fd, buf);
+  }
+
+  bool write(std::vector<std::string> &&bufs) override {
+    return detail::writeAll(m_fd, std::span<const std::string>(bufs));
+  }
+
+private:
+  int m_fd;
+};
+
+// Collects the stream in memory
+class BufferTransport final : public Transport {
+public:
+  using Transport::write;
+
+  bool write(std::string_view buf) override {
+    m_buf += buf;
+    return true;
+  }
+
+  const std::string &buffer() const { return m_buf; }
+
+  void clear() { m_buf.clear(); }
+
+private:
+  std::string m_buf;
+};
+
+using TransportPtr = std::shared_ptr<Transport>;
+
+// Writes to several gnuplot processes through one io_uring, so that a single
+// thread can feed many plots without blocking on the slowest one. update()
+// only queues the frame; call submit() after updating the plots to write all
+// frames in one batch (waitFrame() and the next update() submit, too).
+// Without io_uring support, transports fall back to blocking writes.
+// Plots using the same IoUring must be updated from the same thread.
+class IoUring {
+public:
+  IoUring(unsigned entries = 64)
+      : m_ring(std::make_shared<detail::Uring>(entries)) {}
+
+  bool available() const { return m_ring->available(); }
+
+  // Creates a gnuplot process transport, to be passed to Plot's constructor
+  TransportPtr createTransport() const {
+    auto process = std::make_shared<detail::Process>();
+    if (m_ring->available())
+      process->ring(m_ring);
+
+    return process;
+  }
+
+  // Submits all queued writes. Returns false on error.
+  bool submit() { return !m_ring->available() || m_ring->submit(); }
+
+  // Waits until a write has completed, then submits what became ready
+  bool reap() { return !m_ring->available() || m_ring->reap(); }
+
+private:
+  std::shared_ptr<detail::Uring> m_ring;
+};
+
+// Keeps up to size idle gnuplot processes ready, so that opening a plot does
+// not have to wait for gnuplot to start up. Pass acquire()'s result to Plot's
+// constructor. When the plot is destroyed, its process is reset and returned
+// to the pool.
+class ProcessPool {
+public:
+  ProcessPool(std::size_t size) : m_state(std::make_shared<State>()) {
+    m_state->size = size;
+    fill();
+  }
+
+  ProcessPool(const ProcessPool &) = delete;
+  ProcessPool &operator=(const ProcessPool &) = delete;
+
+  // Returns an idle process, or a new one if there is none. The pool is
+  // refilled afterwards.
+  TransportPtr acquire() {
+    std::unique_ptr<detail::Process> process;
+
+    {
+      std::lock_guard lock(m_state->mutex);
+      if (!m_state->idle.empty()) {
+        process = std::move(m_state->idle.back());
+        m_state->idle.pop_back();
+      }
+    }
+
+    if (!process) {
+      process = std::make_unique<detail::Process>();
+      process->start();
+    }
+
+    TransportPtr transport(process.release(),
+                           [state = std::weak_ptr(m_state)](
+                               detail::Process *process) {
+                             release(state, process);
+                           });
+
+    // Spawning only waits for exec, gnuplot initializes in the background
+    fill();
+
+    return transport;
+  }
+
+  std::size_t idle() const {
+    std::lock_guard lock(m_state->mutex);
+    return m_state->idle.size();
+  }
+
+private:
+  struct State {
+    mutable std::mutex mutex;
+    std::size_t size;
+    std::vector<std::unique_ptr<detail::Process>> idle;
+  };
+
+  void fill() {
+    std::unique_lock lock(m_state->mutex);
+
+    while (m_state->idle.size() < m_state->size) {
+      lock.unlock();
+      auto process = std::make_unique<detail::Process>();
+      process->start();
+      lock.lock();
+
+      // Another thread may have refilled the pool meanwhile
+      if (m_state->idle.size() < m_state->size)
+        m_state->idle.push_back(std::move(process));
+    }
+  }
+
+  // Runs as the deleter of acquired transports, so it must neither block on
+  // gnuplot nor throw. A process which cannot be reset right away is closed.
+  static void release(const std::weak_ptr<State> &weakState,
+                      detail::Process *ptr) noexcept {
+    std::unique_ptr<detail::Process> process(ptr);
+
+    auto state = weakState.lock();
+    if (!state)
+      return;
+
+    try {
+      if (!process->reset())
+        return;
+
+      std::lock_guard lock(state->mutex);
+      if (state->idle.size() < state->size)
+        state->idle.push_back(std::move(process));
+    } catch (...) {
+    }
+  }
+
+  std::shared_ptr<State> m_state;
+};
+
+// Resumes awaited plot operations (see Plot::updateAsync()) once gnuplot's file
+// descriptors are ready. Implement it to drive them from an existing event
+// loop.
+class Executor {
+public:
+  virtual ~Executor() = default;
+
+  // Calls ready (once) as soon as one of the file descriptors is ready
+  virtual void watch(std::vector<pollfd> fds, std::function<void()> ready) = 0;
+};
+
+using ExecutorPtr = std::shared_ptr<Executor>;
+
+// Executor based on poll(). Call run() (or runOnce()) from the thread which
+// awaits the plot operations.
+class PollExecutor final : public Executor {
+public:
+  void watch(std::vector<pollfd> fds, std::function<void()> ready) override {
+    m_waiters.push_back({std::move(fds), std::move(ready)});
+  }
+
+  // Whether no operation is awaited
+  bool empty() const { return m_waiters.empty(); }
+
+  // Waits up to timeout milliseconds (-1: forever) for file descriptors to
+  // become ready and resumes their operations. Returns false on error.
+  bool runOnce(int timeout = -1) {
+    if (m_waiters.empty())
+      return true;
+
+    std::vector<pollfd> fds;
+    std::vector<std::size_t> owners;
+    for (std::size_t i = 0; i < m_waiters.size(); ++i) {
+      for (const auto &fd : m_waiters[i].fds) {
+        fds.push_back(fd);
+        owners.push_back(i);
+      }
+    }
+
+    if (::poll(fds.data(), fds.size(), timeout) < 0)
+      return errno == EINTR;
+
+    std::vector<bool> isReady(m_waiters.size(), false);
+    for (std::size_t i = 0; i < fds.size(); ++i) {
+      if (fds[i].revents != 0)
+        isReady[owners[i]] = true;
+    }
+
+    // Operations may wait again while they are resumed
+    std::vector<std::function<void()>> ready;
+    std::vector<Waiter> waiting;
+    for (std::size_t i = 0; i < m_waiters.size(); ++i) {
+      if (isReady[i])
+        ready.push_back(std::move(m_waiters[i].ready));
+      else
+        waiting.push_back(std::move(m_waiters[i]));
+    }
+    m_waiters = std::move(waiting);
+
+    for (auto &resume : ready)
+      resume();
+
+    return true;
+  }
+
+  // Runs until no operation is awaited. Returns false on error.
+  bool run() {
+    while (!m_waiters.empty()) {
+      if (!runOnce())
+        return false;
+    }
+
+    return true;
+  }
+
+private:
+  struct Waiter {
+    std::vector<pollfd> fds;
+    std::function<void()> ready;
+  };
+
+  std::vector<Waiter> m_waiters;
+};
+
+// Result of the plot operations which can be co_await'ed. The operation
+// advances whenever the transport's file descriptors (Transport::interest())
+// are ready, as reported by the executor. Without an executor, co_await
+// blocks until the operation is complete.
+template <typename T> class Awaitable {
+public:
+  // advance: moves the operation forward without blocking, returns true when
+  // it is complete; result: the value of the co_await expression
+  Awaitable(TransportPtr transport, ExecutorPtr executor,
+            std::function<bool()> advance, std::function<T()> result)
+      : m_state(std::make_shared<State>(State{
+            std::move(transport), std::move(executor), std::move(advance),
+            std::move(result), {}, {}})) {}
+
+  bool await_ready() { return advance(*m_state); }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    if (!m_state->executor) {
+      block(*m_state);
+      return false;
+    }
+
+    m_state->handle = handle;
+
+    // Continue right away if there is nothing to wait for
+    return schedule(m_state);
+  }
+
+  T await_resume() {
+    if (m_state->error)
+      std::rethrow_exception(m_state->error);
+
+    return m_state->result();
+  }
+
+private:
+  // Owned by the awaitable; the executor only holds a weak reference, so a
+  // coroutine destroyed while suspended is simply never resumed
+  struct State {
+    TransportPtr transport;
+    ExecutorPtr executor;
+    std::function<bool()> advance;
+    std::function<T()> result;
+    std::coroutine_handle<> handle;
+    std::exception_ptr error;
+  };
+
+  // Errors are rethrown by await_resume()
+  static bool advance(State &state) {
+    try {
+      return state.advance();
+    } catch (...) {
+      state.error = std::current_exception();
+      return true;
+    }
+  }
+
+  // Has the executor advance the operation once the transport is ready, and
+  // resume the coroutine when it is complete. Returns false if there is
+  // nothing to wait for (e.g. gnuplot exited).
+  static bool schedule(const std::shared_ptr<State> &state) {
+    auto fds = state->transport->interest();
+    if (fds.empty())
+      return false;
+
+    state->executor->watch(std::move(fds), [weak = std::weak_ptr(state)] {
+      auto state = weak.lock();
+      if (!state)
+        return;
+
+      if (advance(*state) || !schedule(state))
+        state->handle.resume();
+    });
+
+    return true;
+  }
+
+  static void block(State &state) {
+    for (auto fds = state.transport->interest(); !fds.empty();
+         fds = state.transport->interest()) {
+      if (::poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+        state.error = std::make_exception_ptr(std::system_error(
+            errno, std::generic_category(), "Awaitable: poll"));
+        return;
+      }
+
+      if (advance(state))
+        return;
+    }
+  }
+
+  std::shared_ptr<State> m_state;
+};
+
+namespace detail {
+
+struct SeriesDataPriv {
+  SeriesDataPriv(int id)
+      : id(id), format(DataFormat::Text), fd(-1), flushed(0), updateCount(0),
+        dirty(false) {}
+
+  SeriesDataPriv(const SeriesDataPriv &) = delete;
+  SeriesDataPriv &operator=(const SeriesDataPriv &) = delete;
+
+  ~SeriesDataPriv() {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  bool empty() const { return rows() == 0; }
+
+  std::size_t rows() const {
+    return columns.empty() ? 0 : columns.front().size();
+  }
+
+  int id;
+  DataFormat format;
+  // Significant digits of text data (shortest round-trip representation if
+  // unset)
+  std::optional<int> precision;
+  // Memory file gnuplot reads binary data from
+  int fd;
+  // Values are stored column-wise; all columns have the same length
+  std::vector<std::vector<double>> columns;
+  // Number of rows already transferred to gnuplot
+  std::size_t flushed;
+  // PlotPriv::updateCount of the last update which visited this data
+  unsigned updateCount;
+  // Cached data source of the plot command; empty if outdated
+  std::string source;
+  bool dirty;
+};
+
+struct SeriesPriv {
+  SeriesPriv(SeriesDataPrivPtr data, std::string title, std::uint64_t seq)
+      : data(data), title(std::move(title)), plotStyle(PlotStyle::Points),
+        lineWidth(1.0), pointSize(1.0), axes(Axes::X1Y1), seq(seq),
+        dirty(false) {}
+
+  SeriesDataPrivPtr data;
+
+  std::string title;
+  PlotStyle plotStyle;
+  std::optional<Color> color;
+  double lineWidth;
+  std::optional<PointType> pointType;
+  double pointSize;
+  std::optional<Smooth> smooth;
+  AxesPair axes;
+
+  // Cached plot command clause (everything after the data source); rebuilt
+  // when dirty. The style follows the title, at titleSize.
+  std::string clause;
+  std::size_t titleSize = 0;
+
+  std::string_view style() const {
+    return std::string_view(clause).substr(titleSize);
+  }
+
+  // Creation order, which is also the plot order
+  std::uint64_t seq;
+  bool dirty;
+};
+
+// Refers to a series in a SeriesRegistry; invalid once the series is removed
+struct SeriesHandle {
+  std::uint32_t slot = 0;
+  std::uint32_t generation = 0;
+
+  bool operator==(const SeriesHandle &) const = default;
+};
+
+// Series of a plot, stored contiguously in slots which are reused after
+// removal. Series are found by title or handle in constant time.
+class SeriesRegistry {
+public:
+  SeriesHandle add(SeriesDataPrivPtr data, std::string title) {
+    std::uint32_t slot;
+    if (!m_free.empty()) {
+      slot = m_free.back();
+      m_free.pop_back();
+    } else {
+      slot = static_cast<std::uint32_t>(m_slots.size());
+      m_slots.emplace_back();
+    }
+
+    auto &entry = m_slots[slot];
+    entry.series.emplace(std::move(data), title, m_nextSeq++);
+    m_titles.emplace(std::move(title), slot);
+
+    SeriesHandle handle = {slot, entry.generation};
+    m_order.push_back(handle);
+    ++m_size;
+
+    return handle;
+  }
+
+  bool contains(SeriesHandle handle) const {
+    return handle.slot < m_slots.size() &&
+           m_slots[handle.slot].generation == handle.generation &&
+           m_slots[handle.slot].series.has_value();
+  }
+
+  SeriesPriv &operator[](SeriesHandle handle) {
+    assert(contains(handle));
+    return *m_slots[handle.slot].series;
+  }
+
+  // The slot is reused by a later add(), with a new generation
+  void remove(SeriesHandle handle) {
+    assert(contains(handle));
+
+    auto &entry = m_slots[handle.slot];
+    unindex(entry.series->title, handle.slot);
+    entry.series.reset();
+    ++entry.generation;
+
+    m_free.push_back(handle.slot);
+    --m_size;
+    m_compact = false;
+  }
+
+  void retitle(SeriesHandle handle, std::string title) {
+    auto &series = (*this)[handle];
+
+    unindex(series.title, handle.slot);
+    m_titles.emplace(title, handle.slot);
+    series.title = std::move(title);
+  }
+
+  // Returns the first series (in plot order) with the given title
+  std::optional<SeriesHandle> find(std::string_view title) const {
+    auto [it, end] = m_titles.equal_range(title);
+    if (it == end)
+      return {};
+
+    auto first = it->second;
+    for (++it; it != end; ++it) {
+      if (m_slots[it->second].series->seq < m_slots[first].series->seq)
+        first = it->second;
+    }
+
+    return SeriesHandle{first, m_slots[first].generation};
+  }
+
+  std::size_t size() const { return m_size; }
+
+  bool empty() const { return m_size == 0; }
+
+  // Handles of all series in plot order. Handles of removed series are
+  // dropped in one pass on the first call after removals.
+  const std::vector<SeriesHandle> &order() {
+    if (!m_compact) {
+      std::erase_if(m_order, [this](auto handle) { return !contains(handle); });
+      m_compact = true;
+    }
+
+    return m_order;
+  }
+
+private:
+  struct Slot {
+    std::optional<SeriesPriv> series;
+    std::uint32_t generation = 0;
+  };
+
+  struct TitleHash {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view title) const {
+      return std::hash<std::string_view>()(title);
+    }
+  };
+
+  void unindex(std::string_view title, std::uint32_t slot) {
+    auto [it, end] = m_titles.equal_range(title);
+    for (; it != end; ++it) {
+      if (it->second == slot) {
+        m_titles.erase(it);
+        return;
+      }
+    }
+  }
+
+  std::vector<Slot> m_slots;
+  std::vector<std::uint32_t> m_free;
+  std::vector<SeriesHandle> m_order;
+  // Slots by title
+  std::unordered_multimap<std::string, std::uint32_t, TitleHash,
+                          std::equal_to<>>
+      m_titles;
+  std::size_t m_size = 0;
+  std::uint64_t m_nextSeq = 0;
+  // Whether m_order contains no removed series
+  bool m_compact = true;
+};
+
+struct PlotPriv {
+  PlotPriv(std::string title, TransportPtr transport)
+      : transport(std::move(transport)),
+        window(this->transport->allocateWindow()),
+        generation(this->transport->generation()), title(std::move(title)),
+        font("Sans"), fontSize(9), activeDataId(-1), updateCount(0),
+        heldBack(false), frame(0), latency(0), batchDepth(0),
+        updateDeferred(false), queueWrites(false), lost(false), dirty(true) {}
+
+  // Releases the window and data blocks (see Transport::releaseWindow()).
+  // Errors are ignored, gnuplot may be gone already.
+  ~PlotPriv() {
+    try {
+      buf.clear();
+
+      // Nothing of ours survived a restart
+      if (frame > 0 && transport->generation() == generation) {
+        fmt::format_to(std::back_inserter(buf), "set terminal qt {} close\n",
+                       window);
+
+        for (auto handle : series.order()) {
+          const auto &data = *series[handle].data;
+          if (data.format == DataFormat::Text && data.flushed > 0)
+            fmt::format_to(std::back_inserter(buf), "undefine $_{}\n",
+                           data.id);
+        }
+      }
+
+      transport->releaseWindow(buf);
+    } catch (...) {
+    }
+  }
+
+  // Writes to the transport, or stages the buffers while a batch is open
+  bool write(std::string_view buf) {
+    if (batchDepth == 0 && !queueWrites)
+      return transport->write(buf);
+
+    std::vector<std::string> bufs;
+    bufs.emplace_back(buf);
+    return write(std::move(bufs));
+  }
+
+  bool write(std::vector<std::string> &&bufs) {
+    if (batchDepth == 0)
+      return queueWrites ? transport->enqueue(std::move(bufs))
+                         : transport->write(std::move(bufs));
+
+    std::move(bufs.begin(), bufs.end(), std::back_inserter(staged));
+    return true;
+  }
+
+  // Returns an empty buffer, reusing the memory of an earlier frame
+  std::string takeBuffer() {
+    if (spare.empty())
+      return {};
+
+    auto buf = std::move(spare.back());
+    spare.pop_back();
+    return buf;
+  }
+
+  // Keeps the written buffers for reuse, unless the transport took them over
+  // (or they are too large to keep around)
+  void recycle(std::vector<std::string> &bufs) {
+    for (auto &buf : bufs) {
+      if (!buf.empty() && buf.capacity() <= MaxSpareCapacity) {
+        buf.clear();
+        spare.push_back(std::move(buf));
+      }
+    }
+
+    bufs.clear();
+  }
+
+  static constexpr std::size_t MaxSpareCapacity = 1024 * 1024;
+
+  using Clock = std::chrono::steady_clock;
+
+  TransportPtr transport;
+  // Resumes awaited operations (see Plot::updateAsync())
+  ExecutorPtr executor;
+  // qt terminal window number
+  int window;
+  // Transport generation the state was last sent to
+  std::uint64_t generation;
+
+  std::string title;
+  std::string font;
+  int fontSize;
+
+  std::optional<Point> position;
+  std::optional<Size> size;
+
+  std::array<Range, Axes::Count> ranges;
+
+  int activeDataId;
+  SeriesRegistry series;
+
+  unsigned updateCount;
+
+  // Minimum time between frames (autoUpdate)
+  std::optional<Clock::duration> frameInterval;
+  Clock::time_point lastFrame;
+  // Whether the frame rate held back a frame (see Plot::nextDue())
+  bool heldBack;
+
+  // Sequence number of the last frame sent
+  std::uint64_t frame;
+  // Frames sent but not yet acknowledged by gnuplot, with their send time
+  std::deque<std::pair<std::uint64_t, Clock::time_point>> pendingFrames;
+  // Time between sending and acknowledgement of the last acknowledged frame
+  Clock::duration latency;
+
+  std::string buf;
+  // Frame being assembled by update()
+  std::vector<std::string> bufs;
+  // Buffers of written frames, see takeBuffer()
+  std::vector<std::string> spare;
+
+  // Number of open batches (see Plot::batch())
+  int batchDepth;
+  // Writes held back until the outermost batch is closed
+  std::vector<std::string> staged;
+  // Whether update() was called within the batch
+  bool updateDeferred;
+
+  // Settings as last sent to gnuplot. Only those which differ are sent again;
+  // empty if gnuplot's state is unknown.
+  struct Sent {
+    std::string terminal;
+    std::array<std::string, Axes::Count> ranges;
+    std::array<std::string, Axes::Count> tics;
+    std::string titles;
+    std::string plot;
+  } sent;
+  // Settings being assembled by update()
+  std::string line;
+  // Series with data, in plot order, and the number of series in the run of
+  // uniform series starting at each of them
+  std::vector<std::pair<const SeriesPriv *, std::size_t>> plotted;
+
+  // Whether writes are queued rather than blocking (see Plot::updateAsync())
+  bool queueWrites;
+  // Whether a write outside of update() found gnuplot gone (see recover())
+  bool lost;
+  bool dirty;
+};
+
+// Defines the number of columns on the first append and rejects rows of a
+// different width afterwards
+inline void setColumns(SeriesDataPriv &data, std::size_t columns) {
+  if (columns == 0 ||
+      (!data.columns.empty() && data.columns.size() != columns))
+    throw std::invalid_argument(
+        "Series: append: row width does not match the number of columns");
+  if (data.columns.empty())
+    data.columns.resize(columns);
+}
+
+template <Number... Ns> void appendHelper(SeriesDataPriv &data, Ns... args) {
+  setColumns(data, sizeof...(Ns));
+
+  auto column = data.columns.begin();
+  (column++->push_back(static_cast<double>(args)), ...);
+}
+
+template <TupleLikeOfNumbers T, std::size_t... Is>
+void appendHelper(SeriesDataPriv &data, const T &t,
+                  std::index_sequence<Is...>) {
+  using std::get;
+  appendHelper(data, get<Is>(t)...);
+}
+
+template <TupleLikeOfNumbers T>
+void appendHelper(SeriesDataPriv &data, const T &t) {
+  appendHelper(data, t, std::make_index_sequence<std::tuple_size_v<T>>());
+}
+
+// Upper bound for the length of a formatted number (including separator)
+constexpr std::size_t maxNumberSize = 32;
+
+// Writes v to p, which must have room for maxNumberSize characters. Integral
+// values are written without fraction.
+inline char *formatNumber(char *p, double v, std::optional<int> precision) {
+  constexpr double maxExactInt = 9007199254740992.0; // 2^53
+
+  if (v > -maxExactInt && v < maxExactInt &&
+      v == static_cast<double>(static_cast<long long>(v))) {
+    fmt::format_int str(static_cast<long long>(v));
+    return std::copy_n(str.data(), str.size(), p);
+  }
+
+#if defined(__cpp_lib_to_chars)
+  if (precision.has_value())
+    return std::to_chars(p, p + maxNumberSize, v, std::chars_format::general,
+                         precision.value())
+        .ptr;
+
+  return std::to_chars(p, p + maxNumberSize, v).ptr;
+#else
+  if (precision.has_value())
+    return fmt::format_to(p, "{:.{}g}", v, precision.value());
+
+  return fmt::format_to(p, "{}", v);
+#endif
+}
+
+// Formats rows [first, last) as text lines, space-separated. Reserves the
+// worst case up front, but only appends what was formatted, so the buffer is
+// not filled twice.
+inline void formatRows(std::string &buf, const SeriesDataPriv &data,
+                       std::size_t first, std::size_t last) {
+  auto rowSize = data.columns.size() * maxNumberSize;
+
+  buf.reserve(buf.size() + (last - first) * rowSize);
+
+  char number[maxNumberSize];
+  for (auto row = first; row < last; ++row) {
+    for (std::size_t i = 0; i < data.columns.size(); ++i) {
+      if (i > 0)
+        buf += ' ';
+      buf.append(number,
+                 formatNumber(number, data.columns[i][row], data.precision));
+    }
+    buf += '\n';
+  }
+}
+
+// Interleaves rows [first, last) into native-endian binary records
+inline void packRows(std::string &buf, const SeriesDataPriv &data,
+                     std::size_t first, std::size_t last) {
+  auto offset = buf.size();
+  auto recordSize = data.columns.size() * sizeof(double);
+
+  buf.resize(offset + (last - first) * recordSize);
+
+  auto p = buf.data() + offset;
+  for (auto row = first; row < last; ++row) {
+    for (const auto &column : data.columns) {
+      std::memcpy(p, &column[row], sizeof(double));
+      p += sizeof(double);
+    }
+  }
+}
+
+} // namespace detail
+
+class Series {
+  friend class Plot;
+
+public:
+  Series() {}
+  Series(detail::PlotPrivPtr plot, detail::SeriesHandle handle)
+      : m_plot(std::move(plot)), m_handle(handle) {}
+
+  int dataId() const { return priv().data->id; }
+
+  Series &title(std::string title) {
+    auto &series = priv();
+    if (series.title != title) {
+      m_plot->series.retitle(m_handle, std::move(title));
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  // A copy: the title lives in the plot's series registry, which moves it
+  // when series are created
+  std::string title() const { return priv().title; }
+
+  Series &with(PlotStyle plotStyle) {
+    auto &series = priv();
+    if (series.plotStyle != plotStyle) {
+      series.plotStyle = plotStyle;
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  PlotStyle with() const { return priv().plotStyle; }
+
+  Series &color(std::optional<Color> color) {
+    auto &series = priv();
+    if (series.color != color) {
+      series.color = color;
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  std::optional<Color> color() const { return priv().color; }
+
+  Series &lineWidth(double lineWidth) {
+    auto &series = priv();
+    if (series.lineWidth != lineWidth) {
+      series.lineWidth = lineWidth;
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  double lineWidth() const { return priv().lineWidth; }
+
+  Series &pointType(std::optional<PointType> pointType) {
+    auto &series = priv();
+    if (series.pointType != pointType) {
+      series.pointType = pointType;
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  std::optional<PointType> pointType() const { return priv().pointType; }
+
+  Series &pointSize(double pointSize) {
+    auto &series = priv();
+    if (series.pointSize != pointSize) {
+      series.pointSize = pointSize;
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  double pointSize() const { return priv().pointSize; }
+
+  Series &smooth(std::optional<Smooth> smooth) {
+    auto &series = priv();
+    if (series.smooth != smooth) {
+      series.smooth = smooth;
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  std::optional<Smooth> smooth() const { return priv().smooth; }
+
+  Series &axes(AxesPair axes) {
+    auto &series = priv();
+    if (series.axes != axes) {
+      series.axes = axes;
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  AxesPair axes() const { return priv().axes; }
+
+  // Selects how data is transferred to gnuplot. Binary data is written to a
+  // memory file and read by gnuplot without a text conversion. Changing the
+  // format retransfers all data on the next update.
+  Series &dataFormat(DataFormat format) {
+    auto &series = priv();
+    auto &data = *series.data;
+
+    if (data.format != format) {
+      discardTransferred();
+      data.format = format;
+      data.source.clear();
+      series.dirty = true;
+    }
+    return *this;
+  }
+
+  DataFormat dataFormat() const { return priv().data->format; }
+
+  // Limits text data to the given number of significant digits (1-17).
+  // Changing the precision retransfers all data on the next update.
+  Series &precision(std::optional<int> precision) {
+    if (precision.has_value() &&
+        (precision.value() < 1 || precision.value() > 17))
+      throw std::out_of_range("Series: precision must be within 1-17");
+
+    auto &data = *priv().data;
+
+    if (data.precision != precision) {
+      if (data.format == DataFormat::Text)
+        discardTransferred();
+      data.precision = precision;
+    }
+    return *this;
+  }
+
+  std::optional<int> precision() const { return priv().data->precision; }
+
+  template <Number... Ns> Series &append(Ns... args) {
+    auto &data = *priv().data;
+
+    detail::appendHelper(data, args...);
+
+    data.dirty = true;
+
+    return *this;
+  }
+
+  template <TupleLikeOfNumbers T> Series &append(const T &t) {
+    auto &data = *priv().data;
+
+    detail::appendHelper(data, t);
+
+    data.dirty = true;
+
+    return *this;
+  }
+
+  // Appends whole columns at once; all columns must have the same length.
+  template <typename... Spans>
+  Series &append(std::span<const double> first, const Spans &...rest) requires(
+      std::convertible_to<const Spans &, std::span<const double>> &&...) {
+    auto &data = *priv().data;
+    std::array<std::span<const double>, 1 + sizeof...(Spans)> columns{
+        first, std::span<const double>(rest)...};
+
+    for (const auto &column : columns)
+      if (column.size() != first.size())
+        throw std::invalid_argument(
+            "Series: append: columns differ in length");
+
+    detail::setColumns(data, columns.size());
+
+    for (std::size_t i = 0; i < columns.size(); ++i) {
+      auto &column = data.columns[i];
+      column.insert(column.end(), columns[i].begin(), columns[i].end());
+    }
+
+    data.dirty = true;
+
+    return *this;
+  }
+
+  template <std::input_iterator I, std::sentinel_for<I> S>
+  Series &append(I first, S last) requires(IsNumberV<std::iter_value_t<I>>) {
+    // An empty row has no column-wise representation; ignore it
+    if (first == last)
+      return *this;
+
+    auto &data = *priv().data;
+    bool define = data.columns.empty();
+    std::size_t column = 0;
+
+    // Removes the partially appended row before reporting a width mismatch
+    auto reject = [&] {
+      for (std::size_t i = 0; i < column; ++i)
+        data.columns[i].pop_back();
+      if (define)
+        data.columns.clear();
+      throw std::invalid_argument(
+          "Series: append: row width does not match the number of columns");
+    };
+
+    for (; first != last; ++column) {
+      if (define)
+        data.columns.emplace_back();
+      else if (column == data.columns.size())
+        reject();
+
+      data.columns[column].push_back(static_cast<double>(*(first++)));
+    }
+
+    if (column != data.columns.size())
+      reject();
+
+    data.dirty = true;
+
+    return *this;
+  }
+
+  template <std::input_iterator I, std::sentinel_for<I> S>
+  Series &
+  append(I first,
+         S last) requires(!IsNumberV<std::iter_value_t<I>> &&
+                          IsTupleLikeOfNumbersV<std::iter_value_t<I>>) {
+    if (first == last)
+      return *this;
+
+    auto &data = *priv().data;
+
+    std::for_each(first, last,
+                  [&](const auto &t) { detail::appendHelper(data, t); });
+
+    data.dirty = true;
+
+    return *this;
+  }
+
+  Series &clear() {
+    auto &data = *priv().data;
+
+    discardTransferred();
+    data.columns.clear();
+    data.source.clear();
+
+    return *this;
+  }
+
+  // Like clear(), but completes once gnuplot has been told to drop the data
+  // (see Plot::updateAsync())
+  Awaitable<void> clearAsync();
+
+  // Stable identifier, see Plot::getSeriesById()
+  std::uint64_t id() const {
+    assert(m_plot);
+    return (static_cast<std::uint64_t>(m_handle.generation) << 32) |
+           m_handle.slot;
+  }
+
+  // False if default-constructed or removed from the plot (also through
+  // another copy)
+  operator bool() const {
+    return m_plot && m_plot->series.contains(m_handle);
+  }
+
+private:
+  // Drops the data gnuplot holds for this data series; everything is
+  // transferred again on the next update.
+  void discardTransferred() {
+    auto &plot = *m_plot;
+    auto &data = *priv().data;
+
+    if (data.flushed == 0)
+      return;
+
+    data.flushed = 0;
+    data.dirty = true;
+
+    // The memory file is ours, whatever became of gnuplot
+    if (data.format == DataFormat::Binary) {
+      if (data.fd >= 0 &&
+          (::ftruncate(data.fd, 0) < 0 || ::lseek(data.fd, 0, SEEK_SET) < 0))
+        throw std::system_error(errno, std::generic_category(),
+                                "Series: truncate memory file");
+
+      return;
+    }
+
+    // A gnuplot which exited or was replaced holds no datablock to undefine;
+    // the next update recovers and transfers everything again
+    if (plot.transport->eof() ||
+        plot.generation != plot.transport->generation())
+      return;
+
+    plot.buf.clear();
+    fmt::format_to(std::back_inserter(plot.buf), "undefine $_{}\n", data.id);
+
+    if (!plot.write(plot.buf)) {
+      if (errno == EPIPE) {
+        plot.lost = true;
+        return;
+      }
+
+      throw std::system_error(errno, std::generic_category(),
+                              "Series: clear: write");
+    }
+  }
+
+  detail::SeriesPriv &priv() const {
+    if (!*this)
+      throw std::logic_error("Series: not part of a plot");
+
+    return m_plot->series[m_handle];
+  }
+
+  detail::PlotPrivPtr m_plot;
+  detail::SeriesHandle m_handle;
+};
+
+class Plot {
+  friend class Series;
+
+public:
+  Plot() {}
+
+  Plot(std::string title)
+      : Plot(std::move(title), std::make_shared<detail::Process>()) {}
+
+  Plot(std::string title, TransportPtr transport)
+      : m_plot(std::make_shared<detail::PlotPriv>(std::move(title),
+                                                  std::move(transport))) {}
+
+  Plot(detail::PlotPrivPtr plot) : m_plot(plot) {}
+
+  Plot &title(std::string title) {
+    assert(m_plot);
+    if (m_plot->title != title) {
+      m_plot->title = std::move(title);
+      m_plot->dirty = true;
+    }
+    return *this;
+  }
+
+  const std::string &title() const {
+    assert(m_plot);
+    return m_plot->title;
+  }
+
+  Plot &font(std::string font) {
+    assert(m_plot);
+    if (m_plot->font != font) {
+      m_plot->font = std::move(font);
+      m_plot->dirty = true;
+    }
+    return *this;
+  }
+
+  Plot &font(std::string font, int fontSize) {
+    assert(m_plot);
+    if (m_plot->font != font || m_plot->fontSize != fontSize) {
       m_plot->font = std::move(font);
+      m_plot->fontSize = fontSize;
+      m_plot->dirty = true;
+    }
+    return *this;
+  }
+
+  const std::string &font() const {
+    assert(m_plot);
+    return m_plot->font;
+  }
+
+  Plot &fontSize(int fontSize) {
+    assert(m_plot);
+    if (m_plot->fontSize != fontSize) {
+      m_plot->fontSize = fontSize;
+      m_plot->dirty = true;
+    }
+    return *this;
+  }
+
+  int fontSize() const {
+    assert(m_plot);
+    return m_plot->fontSize;
+  }
+
+  Plot &position(std::optional<Point> position) {
+    assert(m_plot);
+    if (m_plot->position != position) {
+      m_plot->position = position;
+      m_plot->dirty = true;
+    }
+    return *this;
+  }
+
+  Plot &position(int x, int y) { return position(Point(x, y)); }
+
+  std::optional<Point> position() const {
+    assert(m_plot);
+    return m_plot->position;
+  }
+
+  Plot &size(std::optional<Size> size) {
+    assert(m_plot);
+    if (m_plot->size != size) {
+      m_plot->size = size;
+      m_plot->dirty = true;
+    }
+    return *this;
+  }
+
+  Plot &size(int width, int height) { return size(Size(width, height)); }
+
+  std::optional<Size> size() const {
+    assert(m_plot);
+    return m_plot->size;
+  }
+
+  Plot &range(Axis axis, const Range &range) {
+    assert(m_plot);
+    auto &m_range = m_plot->ranges[detail::axisIndex(axis)];
+    if (m_range != range) {
+      m_range = range;
       m_plot->dirty = true;
     }
     return *this;
   }
 
-  Plot &font(std::string font, int fontSize) {
+  Plot &range(Axis axis, const RangeValue &min, const RangeValue &max) {
+    return range(axis, {min, max});
+  }
+
+  const Range &range(Axis axis) const {
+    assert(m_plot);
+    return m_plot->ranges[detail::axisIndex(axis)];
+  }
+
+  const TransportPtr &transport() const {
+    assert(m_plot);
+    return m_plot->transport;
+  }
+
+  // In asynchronous mode, commands and data are handed to a writer thread
+  // and update() does not block while gnuplot is busy.
+  Plot &async(bool async) {
+    assert(m_plot);
+    [[maybe_unused]] bool supported = m_plot->transport->async(async);
+    assert(supported);
+    return *this;
+  }
+
+  bool async() const {
+    assert(m_plot);
+    return m_plot->transport->async();
+  }
+
+  // Non-blocking mode for event loops: update() never waits for gnuplot. What
+  // the pipe does not accept is queued and written by pump(), which should be
+  // called when one of the file descriptors returned by interest() is ready.
+  Plot &nonBlocking(bool nonBlocking) {
+    assert(m_plot);
+    [[maybe_unused]] bool supported =
+        m_plot->transport->nonBlocking(nonBlocking);
+    assert(supported);
+    return *this;
+  }
+
+  bool nonBlocking() const {
+    assert(m_plot);
+    return m_plot->transport->nonBlocking();
+  }
+
+  // File descriptors to watch (e.g. with epoll), with the events of interest.
+  // Changes with every update() and pump().
+  std::vector<pollfd> interest() const {
+    assert(m_plot);
+    return m_plot->transport->interest();
+  }
+
+  // Writes queued frames as far as possible and handles gnuplot's output,
+  // without blocking
+  void pump() {
     assert(m_plot);
-    if (m_plot->font != font || m_plot->fontSize != fontSize) {
-      m_plot->font = std::move(font);
-      m_plot->fontSize = fontSize;
-      m_plot->dirty = true;
+
+    if (!m_plot->transport->pump()) {
+      if (errno != EPIPE)
+        throw std::system_error(errno, std::generic_category(),
+                                "Plot: pump: write");
+
+      // gnuplot died; the next update() sends everything again
+      recover(true);
     }
+
+    pollOutput(0);
+
+    // A frame held back while gnuplot was busy goes out once it is done
+    if (m_plot->heldBack && m_plot->batchDepth == 0)
+      updateNow();
+  }
+
+  // Runs the continuations of awaited operations (see updateAsync()). Without
+  // an executor, co_await blocks until the operation is complete.
+  Plot &executor(ExecutorPtr executor) {
+    assert(m_plot);
+    m_plot->executor = std::move(executor);
     return *this;
   }
 
-  const std::string &font() const {
+  const ExecutorPtr &executor() const {
     assert(m_plot);
-    return m_plot->font;
+    return m_plot->executor;
   }
 
-  Plot &fontSize(int fontSize) {
+  // Capacity of the pipe to gnuplot (if supported by the transport)
+  Plot &bufferSize(std::size_t size) {
     assert(m_plot);
-    if (m_plot->fontSize != fontSize) {
-      m_plot->fontSize = fontSize;
-      m_plot->dirty = true;
-    }
+    m_plot->transport->bufferSize(size);
     return *this;
   }
 
-  int fontSize() const {
+  std::size_t bufferSize() const {
     assert(m_plot);
-    return m_plot->fontSize;
+    return m_plot->transport->bufferSize();
   }
 
-  Plot &position(std::optional<Point> position) {
+  // Blocks until all commands and data have been written to gnuplot,
+  // including a frame held back by the frame rate (see autoUpdate())
+  void flush() {
     assert(m_plot);
-    if (m_plot->position != position) {
-      m_plot->position = position;
-      m_plot->dirty = true;
-    }
-    return *this;
+
+    if (m_plot->heldBack && m_plot->batchDepth == 0)
+      updateNow(true);
+
+    if (!m_plot->transport->wait())
+      throw std::system_error(errno, std::generic_category(),
+                              "Plot: flush: write");
   }
 
-  Plot &position(int x, int y) { return position(Point(x, y)); }
+  // Limits update() to the given frame rate. Within a frame interval, or
+  // while gnuplot is still reading the previous frame, update() returns
+  // without sending anything; changes accumulate and are sent by the next
+  // update() which is due. To show the last changes, call update() again at
+  // nextDue(), or flush().
+  Plot &autoUpdate(std::optional<double> fps) {
+    assert(m_plot);
+    assert(!fps.has_value() || fps.value() > 0.0);
 
-  std::optional<Point> position() const {
+    if (fps.has_value())
+      m_plot->frameInterval =
+          std::chrono::duration_cast<detail::PlotPriv::Clock::duration>(
+              std::chrono::duration<double>(1.0 / fps.value()));
+    else
+      m_plot->frameInterval.reset();
+
+    return *this;
+  }
+
+  std::optional<double> autoUpdate() const {
     assert(m_plot);
-    return m_plot->position;
+
+    if (!m_plot->frameInterval.has_value())
+      return {};
+
+    return 1.0 / std::chrono::duration<double>(m_plot->frameInterval.value())
+                     .count();
   }
 
-  Plot &size(std::optional<Size> size) {
+  // When update() can send the frame the frame rate held back; empty if there
+  // is none. Also empty while the interval has passed, but gnuplot is still
+  // busy with the previous frame: pump() sends the frame once gnuplot is done.
+  std::optional<std::chrono::steady_clock::time_point> nextDue() const {
     assert(m_plot);
-    if (m_plot->size != size) {
-      m_plot->size = size;
-      m_plot->dirty = true;
-    }
-    return *this;
+
+    if (!m_plot->heldBack || !m_plot->frameInterval.has_value())
+      return {};
+
+    auto due = m_plot->lastFrame + m_plot->frameInterval.value();
+    if (due <= detail::PlotPriv::Clock::now() &&
+        (m_plot->transport->busy() || !m_plot->pendingFrames.empty()))
+      return {};
+
+    return due;
   }
 
-  Plot &size(int width, int height) { return size(Size(width, height)); }
+  // Sequence number of the last frame sent to gnuplot
+  std::uint64_t frame() const {
+    assert(m_plot);
+    return m_plot->frame;
+  }
 
-  std::optional<Size> size() const {
+  // Sequence number of the last frame gnuplot has finished plotting
+  // (the last frame written for transports without acknowledgements)
+  std::uint64_t renderedFrame() {
     assert(m_plot);
-    return m_plot->size;
+
+    if (!m_plot->transport->acknowledges())
+      return m_plot->frame;
+
+    pollOutput(0);
+    return m_plot->transport->acked(m_plot->window);
   }
 
-  Plot &range(Axis axis, const Range &range) {
+  // Waits until gnuplot has finished plotting the given frame. Returns false
+  // on timeout or if gnuplot exited.
+  bool waitFrame(std::uint64_t frame,
+                 std::optional<std::chrono::milliseconds> timeout = {}) {
     assert(m_plot);
-    auto &m_range = m_plot->ranges[detail::axisIndex(axis)];
-    if (m_range != range) {
-      m_range = range;
-      m_plot->dirty = m_plot->rangesDirty = true;
+
+    if (!m_plot->transport->acknowledges()) {
+      flush();
+      return frame <= m_plot->frame;
     }
-    return *this;
+
+    using Clock = detail::PlotPriv::Clock;
+    auto deadline =
+        Clock::now() + timeout.value_or(std::chrono::milliseconds::zero());
+
+    while (m_plot->transport->acked(m_plot->window) < frame &&
+           !m_plot->transport->eof()) {
+      int ms = -1;
+      if (timeout.has_value()) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(
+            deadline - Clock::now());
+        if (left.count() <= 0)
+          return false;
+        ms = static_cast<int>(left.count());
+      }
+
+      pollOutput(ms);
+    }
+
+    return m_plot->transport->acked(m_plot->window) >= frame;
   }
 
-  Plot &range(Axis axis, const RangeValue &min, const RangeValue &max) {
-    return range(axis, {min, max});
+  // Awaitable version of waitFrame(), without timeout
+  Awaitable<bool> waitFrameAsync(std::uint64_t frame) {
+    assert(m_plot);
+
+    if (!m_plot->transport->acknowledges())
+      return {m_plot->transport, m_plot->executor, written(),
+              [plot = m_plot, frame] { return frame <= plot->frame; }};
+
+    auto rendered = [plot = m_plot, frame] {
+      return plot->transport->acked(plot->window) >= frame;
+    };
+
+    return {m_plot->transport, m_plot->executor,
+            [plot = *this, rendered]() mutable {
+              plot.pump();
+              return rendered() || plot.m_plot->transport->eof();
+            },
+            rendered};
   }
 
-  const Range &range(Axis axis) const {
+  // Time between sending the last acknowledged frame and gnuplot finishing
+  // plotting it
+  std::chrono::steady_clock::duration latency() {
     assert(m_plot);
-    return m_plot->ranges[detail::axisIndex(axis)];
+    pollOutput(0);
+    return m_plot->latency;
   }
 
-  Series createSeries(std::string title) {
+  // Returns (and forgets) everything gnuplot printed, e.g. error messages
+  std::vector<std::string> messages() {
     assert(m_plot);
+    pollOutput(0);
+    return m_plot->transport->takeMessages();
+  }
 
-    auto data = std::make_shared<detail::SeriesDataPriv>(m_plot->nextDataId++);
-    auto series =
-        std::make_shared<detail::SeriesPriv>(*m_plot, data, std::move(title));
+  Series createSeries(std::string title) {
+    assert(m_plot);
 
-    m_plot->series.push_back(series);
+    auto data = std::make_shared<detail::SeriesDataPriv>(
+        m_plot->transport->allocateDataId());
 
-    return {series};
+    return {m_plot, m_plot->series.add(std::move(data), std::move(title))};
   }
 
   Series createSeries(std::string title, const Series &dataSource) {
     assert(m_plot);
 
-    auto series = std::make_shared<detail::SeriesPriv>(
-        *m_plot, dataSource.m_series->data, std::move(title));
-
-    m_plot->series.push_back(series);
-
-    return {series};
+    return {m_plot,
+            m_plot->series.add(dataSource.priv().data, std::move(title))};
   }
 
   std::size_t numSeries() {
@@ -1235,8 +3842,9 @@ public:
   Series getSeries(std::size_t index) {
     assert(m_plot);
 
-    if (index < m_plot->series.size())
-      return {m_plot->series[index]};
+    const auto &order = m_plot->series.order();
+    if (index < order.size())
+      return {m_plot, order[index]};
 
     return {};
   }
@@ -1244,163 +3852,609 @@ public:
   Series findSeries(std::string_view title) {
     assert(m_plot);
 
-    for (auto series : m_plot->series) {
-      if (series->title == title)
-        return {series};
-    }
+    if (auto handle = m_plot->series.find(title); handle.has_value())
+      return {m_plot, handle.value()};
+
+    return {};
+  }
+
+  // Looks up a series by its Series::id()
+  Series getSeriesById(std::uint64_t id) {
+    assert(m_plot);
+
+    detail::SeriesHandle handle = {static_cast<std::uint32_t>(id),
+                                   static_cast<std::uint32_t>(id >> 32)};
+    if (m_plot->series.contains(handle))
+      return {m_plot, handle};
 
     return {};
   }
 
+  // Invalidates all handles of the series, including the one passed
   void removeSeries(Series &series) {
     assert(m_plot);
     assert(series);
-    assert(m_plot.get() == &series.m_series->plot);
+    assert(m_plot == series.m_plot);
 
     series.clear();
-    series.m_series->removed = true;
+    m_plot->series.remove(series.m_handle);
     m_plot->dirty = true;
+
+    series = {};
   }
 
-  void update() {
-    using namespace detail;
+  // Returns false if the frame was deferred (see autoUpdate and batch)
+  bool update() {
+    assert(m_plot);
+
+    if (m_plot->batchDepth > 0) {
+      m_plot->updateDeferred = true;
+      return false;
+    }
+
+    return updateNow();
+  }
+
+  // Holds back all writes of the plot and its series (e.g. those of clear()
+  // and removeSeries()) until the batch is closed, then writes them at once.
+  // update() within a batch only marks the plot for updating; the frame is
+  // sent when the batch is closed, regardless of autoUpdate's frame rate.
+  // Batches may be nested.
+  class Batch {
+  public:
+    Batch(Batch &&other) : m_plot(std::exchange(other.m_plot, {})) {}
+
+    Batch(const Batch &) = delete;
+    Batch &operator=(const Batch &) = delete;
+
+    // Errors are ignored, call close() to handle them
+    ~Batch() {
+      try {
+        close();
+      } catch (...) {
+      }
+    }
+
+    // Closes the batch, throws if writing failed
+    void close() {
+      if (m_plot)
+        Plot(std::exchange(m_plot, {})).endBatch();
+    }
+
+  private:
+    friend class Plot;
+
+    Batch(detail::PlotPrivPtr plot) : m_plot(std::move(plot)) {
+      ++m_plot->batchDepth;
+    }
+
+    detail::PlotPrivPtr m_plot;
+  };
+
+  Batch batch() {
+    assert(m_plot);
+    return {m_plot};
+  }
 
+  // Like update(), but does not wait for gnuplot: the frame is queued and
+  // written as gnuplot reads (if the transport supports it), so that
+  // co_await'ing the result overlaps the transfer with other work. The result
+  // is update()'s.
+  Awaitable<bool> updateAsync() {
     assert(m_plot);
 
-    if (m_plot->series.empty())
+    bool sent = queueWrites([this] { return update(); });
+
+    return {m_plot->transport, m_plot->executor, written(),
+            [sent] { return sent; }};
+  }
+
+  operator bool() const { return (bool)m_plot; }
+
+private:
+  // Sends the deferred frame and writes everything staged by the batch
+  void endBatch() {
+    if (m_plot->batchDepth > 1) {
+      --m_plot->batchDepth;
+      return;
+    }
+
+    // The deferred frame is staged, too
+    bool deferred = std::exchange(m_plot->updateDeferred, false);
+    try {
+      if (deferred)
+        updateNow(true);
+    } catch (...) {
+      m_plot->batchDepth = 0;
+      m_plot->staged.clear();
+      throw;
+    }
+
+    m_plot->batchDepth = 0;
+    auto staged = std::move(m_plot->staged);
+    m_plot->staged.clear();
+
+    if (staged.empty() || m_plot->transport->write(std::move(staged)))
       return;
 
+    if (errno != EPIPE)
+      throw std::system_error(errno, std::generic_category(),
+                              "Plot: batch: write");
+
+    // gnuplot died; send the complete state again
+    recover(true);
+    if (deferred)
+      updateNow(true);
+  }
+
+  // force: sends the frame even if autoUpdate's frame rate would delay it
+  bool updateNow(bool force = false) {
+    using namespace detail;
+
+    if (m_plot->series.empty())
+      return true;
+
+    pollOutput(0);
+    recover(false);
+
+    if (m_plot->frameInterval.has_value()) {
+      auto now = PlotPriv::Clock::now();
+
+      if (!force &&
+          (now - m_plot->lastFrame < m_plot->frameInterval.value() ||
+           m_plot->transport->busy() || !m_plot->pendingFrames.empty())) {
+        m_plot->heldBack = true;
+        return false;
+      }
+
+      m_plot->lastFrame = now;
+    }
+
+    m_plot->heldBack = false;
+
+    if (!writeFrame()) {
+      // gnuplot died while we were writing
+      recover(true);
+
+      if (!writeFrame())
+        throw std::system_error(EPIPE, std::generic_category(),
+                                "Plot: update: write");
+    }
+
+    return true;
+  }
+
+  // Runs f with the plot's writes queued instead of blocking
+  template <typename F> std::invoke_result_t<F> queueWrites(F f) {
+    m_plot->queueWrites = true;
+
+    try {
+      auto result = f();
+      m_plot->queueWrites = false;
+      return result;
+    } catch (...) {
+      m_plot->queueWrites = false;
+      throw;
+    }
+  }
+
+  // Completes once the transport has written everything queued so far
+  Awaitable<void> awaitWritten() {
+    return {m_plot->transport, m_plot->executor, written(), [] {}};
+  }
+
+  std::function<bool()> written() {
+    return [plot = *this]() mutable {
+      plot.pump();
+      return !plot.m_plot->transport->pending();
+    };
+  }
+
+  // Returns false if gnuplot has gone away
+  bool writeFrame() {
+    using namespace detail;
+
     auto &buf = m_plot->buf;
+    auto &bufs = m_plot->bufs;
+
+    bufs.clear();
+    ++m_plot->updateCount;
 
     bool dirty = m_plot->dirty;
-    bool axesDirty = false;
-    std::array<bool, Axes::Count> axisUsed;
-    for (auto it = m_plot->series.begin(); it != m_plot->series.end();) {
-      auto &series = *it;
-      if (series->removed) {
-        it = m_plot->series.erase(it);
-        dirty = true;
-        continue;
+    bool empty = true;
+    std::array<bool, Axes::Count> axisUsed = {};
+    for (auto handle : m_plot->series.order()) {
+      auto &series = m_plot->series[handle];
+      auto &data = *series.data;
+
+      // Data shared by several series is only visited once per update
+      if (data.updateCount != m_plot->updateCount) {
+        data.updateCount = m_plot->updateCount;
+
+        if (data.dirty) {
+          if (data.flushed < data.rows())
+            writeData(data);
+
+          data.dirty = false;
+          dirty = true;
+        }
       }
 
-      if (!series->data->empty()) {
-        dirty |= series->dirty | series->data->dirty;
-        series->dirty = series->data->dirty = false;
-
-        buf.clear();
-        fmt::format_to(std::back_inserter(buf), "$_{} <<EOD\n",
-                       series->data->id);
-        if (!m_plot->gp.write(buf) || !m_plot->gp.write(series->data->buf) ||
-            !m_plot->gp.write("EOD\n"))
-          throw std::system_error(errno, std::generic_category(),
-                                  "Plot: update: write data block here-doc");
-
-        if (series->axesDirty) {
-          axisUsed[axisIndex(series->axes.x())] = true;
-          axisUsed[axisIndex(series->axes.y())] = true;
-          series->axesDirty = false;
-          axesDirty = true;
+      if (!data.empty()) {
+        if (series.dirty || series.clause.empty()) {
+          formatClause(series);
+          series.dirty = false;
+          dirty = true;
         }
+
+        if (data.source.empty())
+          formatSource(data);
+
+        axisUsed[axisIndex(series.axes.x())] = true;
+        axisUsed[axisIndex(series.axes.y())] = true;
+        empty = false;
       }
-      it++;
     }
 
-    if (dirty) {
+    // Another plot sharing the transport has changed gnuplot's settings
+    if (dirty && m_plot->transport->switchTo(m_plot.get()))
+      m_plot->sent = {};
+
+    if (dirty && !empty) {
+      auto &line = m_plot->line;
+      auto &sent = m_plot->sent;
+
       buf.clear();
 
-      fmt::format_to(std::back_inserter(buf),
-                     "set terminal qt enhanced title \"{}\" font \"{},{}\"",
-                     m_plot->title, m_plot->font, m_plot->fontSize);
+      line.clear();
+      fmt::format_to(std::back_inserter(line),
+                     "set terminal qt {} enhanced title \"{}\" font \"{},{}\"",
+                     m_plot->window, m_plot->title, m_plot->font,
+                     m_plot->fontSize);
 
       if (m_plot->position.has_value()) {
         const auto &[x, y] = m_plot->position.value();
-        fmt::format_to(std::back_inserter(buf), " position {},{}", x, y);
+        fmt::format_to(std::back_inserter(line), " position {},{}", x, y);
       }
 
       if (m_plot->size.has_value()) {
         const auto &[w, h] = m_plot->size.value();
-        fmt::format_to(std::back_inserter(buf), " size {},{}", w, h);
+        fmt::format_to(std::back_inserter(line), " size {},{}", w, h);
       }
 
-      buf += '\n';
-      if (!m_plot->gp.write(buf))
-        throw std::system_error(errno, std::generic_category(),
-                                "Plot: update: write set term command");
+      line += '\n';
+      sendIfChanged(line, sent.terminal);
+
+      for (auto [axis, index] :
+           {axisWithIndexPair(Axes::X1), axisWithIndexPair(Axes::Y1),
+            axisWithIndexPair(Axes::X2), axisWithIndexPair(Axes::Y2)}) {
+        line.clear();
+        fmt::format_to(std::back_inserter(line), "set {}range {}\n", axis,
+                       m_plot->ranges[index]);
+        sendIfChanged(line, sent.ranges[index]);
+
+        line.clear();
+        if (axisUsed[index])
+          fmt::format_to(std::back_inserter(line), "set {}tics scale default\n",
+                         axis);
+        else
+          fmt::format_to(std::back_inserter(line), "unset {}tics\n", axis);
+
+        sendIfChanged(line, sent.tics[index]);
+      }
 
-      buf.clear();
+      auto &plotted = m_plot->plotted;
+      bool iterates = findRuns();
+
+      // Series plotted by iteration take their titles from an array
+      if (iterates) {
+        line.clear();
+        fmt::format_to(std::back_inserter(line), "array _gpxx_titles{}[{}] = [",
+                       m_plot->window, plotted.size());
 
-      bool first = true;
+        for (std::size_t i = 0; i < plotted.size(); ++i) {
+          const auto &series = *plotted[i].first;
+          if (i > 0)
+            line += ',';
+          fmt::format_to(std::back_inserter(line), "\"{}\"", series.title);
+        }
 
-      if (m_plot->rangesDirty || axesDirty) {
-        for (auto [axis, index] :
-             {axisWithIndexPair(Axes::X1), axisWithIndexPair(Axes::Y1),
-              axisWithIndexPair(Axes::X2), axisWithIndexPair(Axes::Y2)}) {
-          fmt::format_to(std::back_inserter(buf), "set {}range {}\n", axis,
-                         m_plot->ranges[index]);
+        line += "]\n";
+        sendIfChanged(line, sent.titles);
+      }
 
-          if (axisUsed[index])
-            fmt::format_to(std::back_inserter(buf),
-                           "set {}tics scale default\n", axis);
-          else
-            fmt::format_to(std::back_inserter(buf), "unset {}tics\n", axis);
+      line.clear();
+      line += "plot ";
+
+      for (std::size_t i = 0; i < plotted.size();) {
+        const auto &[series, run] = plotted[i];
+
+        if (i > 0)
+          line += ',';
+
+        if (run > 1) {
+          auto first = series->data->id;
+          fmt::format_to(std::back_inserter(line),
+                         "for [i={}:{}] '$_'.i title _gpxx_titles{}[i{:+}]",
+                         first, first + static_cast<int>(run) - 1,
+                         m_plot->window, static_cast<int>(i) + 1 - first);
+          line += series->style();
+        } else {
+          line += series->data->source;
+          line += series->clause;
         }
-        m_plot->rangesDirty = false;
+
+        i += run;
       }
 
-      buf += "plot ";
+      line += '\n';
 
-      for (auto series : m_plot->series) {
-        if (series->data->empty())
-          continue;
+      // Only the data changed
+      if (line == sent.plot)
+        buf += "replot\n";
+      else
+        sendIfChanged(line, sent.plot);
 
-        if (!first)
-          buf += ',';
+      ++m_plot->frame;
 
-        first = false;
+      // gnuplot prints the acknowledgement once it has finished plotting
+      bool acknowledges = m_plot->transport->acknowledges();
+      if (acknowledges)
+        fmt::format_to(std::back_inserter(buf), "print \"{}{} {}\"\n",
+                       Process::AckPrefix, m_plot->window, m_plot->frame);
 
-        fmt::format_to(std::back_inserter(buf), "$_{} title \"{}\"",
-                       series->data->id, series->title);
+      bufs.push_back(std::exchange(buf, m_plot->takeBuffer()));
 
-        if (plotStyleLUT.contains(series->plotStyle))
-          fmt::format_to(std::back_inserter(buf), " with {}",
-                         plotStyleLUT[series->plotStyle]);
+      if (!sendFrame(acknowledges))
+        return false;
+
+      m_plot->dirty = false;
+    }
 
-        if (series->color.has_value())
-          fmt::format_to(std::back_inserter(buf), " linecolor rgb {}",
-                         series->color.value().rgba());
+    return sendFrame(false);
+  }
 
-        fmt::format_to(std::back_inserter(buf), " linewidth {}",
-                       series->lineWidth);
+  // Collects the series to plot and finds runs of text data series which only
+  // differ in their title and whose data blocks are numbered consecutively.
+  // Such runs are plotted by iteration (plot for [...]), so that the command
+  // does not grow with the number of series. Returns true if there are any.
+  bool findRuns() {
+    auto &plotted = m_plot->plotted;
+    bool iterates = false;
+
+    plotted.clear();
+    for (auto handle : m_plot->series.order()) {
+      const auto &series = m_plot->series[handle];
+      if (!series.data->empty())
+        plotted.emplace_back(&series, 1);
+    }
 
-        if (series->pointType.has_value()) {
-          fmt::format_to(std::back_inserter(buf), " pointtype {} pointsize {}",
-                         static_cast<int>(series->pointType.value()) + 1,
-                         series->pointSize);
-        }
+    for (std::size_t i = 0; i < plotted.size();) {
+      const auto &first = *plotted[i].first;
 
-        if (series->smooth.has_value() &&
-            smoothLUT.contains(series->smooth.value()))
-          fmt::format_to(std::back_inserter(buf), " smooth {}",
-                         smoothLUT[series->smooth.value()]);
+      std::size_t end = i + 1;
+      if (first.data->format == DataFormat::Text) {
+        for (; end < plotted.size(); ++end) {
+          const auto &prev = *plotted[end - 1].first;
+          const auto &next = *plotted[end].first;
 
-        fmt::format_to(std::back_inserter(buf), " axes {}", series->axes);
+          if (next.data->format != DataFormat::Text ||
+              next.data->id != prev.data->id + 1 ||
+              next.style() != first.style())
+            break;
+        }
       }
 
-      if (!first) {
-        buf += '\n';
-        if (!m_plot->gp.write(buf))
-          throw std::system_error(errno, std::generic_category(),
-                                  "Plot: update: write plot command");
+      if (end - i >= MinIterationRun) {
+        plotted[i].second = end - i;
+        iterates = true;
+      } else
+        end = i + 1;
 
-        m_plot->dirty = false;
-      }
+      i = end;
     }
+
+    return iterates;
   }
 
-  operator bool() const { return (bool)m_plot; }
+  // Shorter runs of uniform series are plotted one by one
+  static constexpr std::size_t MinIterationRun = 4;
+
+  // The plot command refers to text data by its data block, to binary data by
+  // its memory file
+  static void formatSource(detail::SeriesDataPriv &data) {
+    auto &source = data.source;
+
+    if (data.format == DataFormat::Binary) {
+      fmt::format_to(std::back_inserter(source),
+                     "'/proc/{}/fd/{}' binary format=\"", ::getpid(), data.fd);
+
+      for (std::size_t i = 0; i < data.columns.size(); ++i)
+        source += "%double";
+
+      source += '"';
+    } else
+      fmt::format_to(std::back_inserter(source), "$_{}", data.id);
+  }
+
+  static void formatClause(detail::SeriesPriv &series) {
+    using namespace detail;
+
+    auto &clause = series.clause;
+
+    clause.clear();
+    fmt::format_to(std::back_inserter(clause), " title \"{}\"", series.title);
+    series.titleSize = clause.size();
+
+    if (plotStyleLUT.contains(series.plotStyle))
+      fmt::format_to(std::back_inserter(clause), " with {}",
+                     plotStyleLUT[series.plotStyle]);
+
+    if (series.color.has_value())
+      fmt::format_to(std::back_inserter(clause), " linecolor rgb {}",
+                     series.color.value().rgba());
+
+    fmt::format_to(std::back_inserter(clause), " linewidth {}",
+                   series.lineWidth);
+
+    if (series.pointType.has_value()) {
+      fmt::format_to(std::back_inserter(clause), " pointtype {} pointsize {}",
+                     static_cast<int>(series.pointType.value()) + 1,
+                     series.pointSize);
+    }
+
+    if (series.smooth.has_value() && smoothLUT.contains(series.smooth.value()))
+      fmt::format_to(std::back_inserter(clause), " smooth {}",
+                     smoothLUT[series.smooth.value()]);
+
+    fmt::format_to(std::back_inserter(clause), " axes {}", series.axes);
+  }
+
+  // Appends the setting to the frame if it differs from what was sent last
+  // time, and remembers it
+  void sendIfChanged(std::string &line, std::string &sent) {
+    if (line == sent)
+      return;
+
+    m_plot->buf += line;
+    std::swap(line, sent);
+  }
+
+  // Writes the assembled frame (data blocks and commands) at once. Returns
+  // false if gnuplot has gone away.
+  bool sendFrame(bool acknowledges) {
+    auto &bufs = m_plot->bufs;
+
+    if (bufs.empty())
+      return true;
+
+    if (!m_plot->write(std::move(bufs))) {
+      if (errno == EPIPE)
+        return false;
+
+      throw std::system_error(errno, std::generic_category(),
+                              "Plot: update: write");
+    }
+
+    m_plot->recycle(bufs);
+
+    if (acknowledges)
+      m_plot->pendingFrames.emplace_back(m_plot->frame,
+                                         detail::PlotPriv::Clock::now());
+
+    return true;
+  }
+
+  // Restarts gnuplot if it has exited (or force is set), and prepares to send
+  // the complete state again if it was restarted since the last update
+  void recover(bool force) {
+    auto &transport = *m_plot->transport;
+
+    force = std::exchange(m_plot->lost, false) || force;
+
+    if ((force || transport.eof()) && !transport.restart())
+      return;
+
+    if (m_plot->generation == transport.generation())
+      return;
+
+    m_plot->generation = transport.generation();
+
+    for (auto handle : m_plot->series.order()) {
+      auto &data = *m_plot->series[handle].data;
+
+      // Binary data lives on in our memory file
+      if (data.format == DataFormat::Text)
+        data.flushed = 0;
+
+      data.dirty = true;
+    }
+
+    m_plot->pendingFrames.clear();
+    m_plot->sent = {};
+    m_plot->dirty = true;
+  }
+
+  void pollOutput(int timeout) {
+    auto &gp = *m_plot->transport;
+
+    if (!gp.poll(timeout))
+      throw std::system_error(errno, std::generic_category(),
+                              "Plot: read gnuplot output");
+
+    auto &pending = m_plot->pendingFrames;
+    auto acked = gp.acked(m_plot->window);
+    while (!pending.empty() && pending.front().first <= acked) {
+      if (pending.front().first == acked)
+        m_plot->latency = gp.ackTime(m_plot->window) - pending.front().second;
+      pending.pop_front();
+    }
+
+    if (gp.eof())
+      pending.clear();
+  }
+
+  // Transfers the rows appended since the last update. The first transfer
+  // defines the data block; later ones are staged in a temporary data block and
+  // appended by printing it into the target.
+  void writeData(detail::SeriesDataPriv &data) {
+    if (data.format == DataFormat::Binary) {
+      writeBinaryData(data);
+      return;
+    }
+
+    auto buf = m_plot->takeBuffer();
+    bool append = data.flushed > 0;
+
+    if (append)
+      buf += "$_append <<EOD\n";
+    else
+      fmt::format_to(std::back_inserter(buf), "$_{} <<EOD\n", data.id);
+
+    detail::formatRows(buf, data, data.flushed, data.rows());
+    buf += "EOD\n";
+
+    if (append)
+      fmt::format_to(std::back_inserter(buf),
+                     "set print $_{} append\nprint $_append\nunset print\n"
+                     "undefine $_append\n",
+                     data.id);
+
+    m_plot->bufs.push_back(std::move(buf));
+
+    data.flushed = data.rows();
+  }
+
+  // Binary data is appended to an anonymous memory file, which gnuplot opens
+  // through our /proc/<pid>/fd entry.
+  void writeBinaryData(detail::SeriesDataPriv &data) {
+    if (data.fd < 0 &&
+        (data.fd = ::memfd_create("gnuplotxx", MFD_CLOEXEC)) < 0)
+      throw std::system_error(errno, std::generic_category(),
+                              "Plot: update: memfd_create");
+
+    auto &buf = m_plot->buf;
+
+    buf.clear();
+    detail::packRows(buf, data, data.flushed, data.rows());
+
+    if (!detail::writeAll(data.fd, buf))
+      throw std::system_error(errno, std::generic_category(),
+                              "Plot: update: write memory file");
+
+    data.flushed = data.rows();
+  }
 
-private:
   detail::PlotPrivPtr m_plot;
 };
 
+inline Awaitable<void> Series::clearAsync() {
+  assert(m_plot);
+
+  Plot plot(m_plot);
+  plot.queueWrites([this] { return &clear(); });
+
+  return plot.awaitWritten();
+}
+
 } // namespace gnuplotxx
@@ -0,0 +1,40 @@
+// Writes frames through an io_uring to a gnuplot which prints everything it
+// reads, then flushes and destroys the plot. Both must return although gnuplot
+// blocks on its output until it is read.
+
+#include <gnuplotxx.h>
+
+#include <cstdio>
+
+using namespace gnuplotxx;
+
+int main() {
+  IoUring ring;
+  if (!ring.available()) {
+    std::puts("io_uring not available");
+    return 77;
+  }
+
+  {
+    Plot plot("uring", ring.createTransport());
+    auto series = plot.createSeries("data");
+
+    for (int frame = 0; frame < 8; ++frame) {
+      for (int i = 0; i < 200000; ++i)
+        series.append(frame * 200000 + i, 0.5 * i);
+
+      plot.update();
+      ring.submit();
+    }
+
+    plot.flush();
+
+    for (int i = 0; i < 200000; ++i)
+      series.append(i, 0.5 * i);
+
+    plot.update();
+  }
+
+  std::puts("ok");
+  return 0;
+}
@@ -0,0 +1,40 @@
+// Writes frames in asynchronous mode to a gnuplot which prints everything it
+// reads, then switches asynchronous mode off and destroys the plot. Both must
+// return although gnuplot blocks on its output until it is read.
+
+#include <gnuplotxx.h>
+
+#include <cstdio>
+
+using namespace gnuplotxx;
+
+static void writeFrames(Plot &plot, Series &series) {
+  for (int frame = 0; frame < 8; ++frame) {
+    for (int i = 0; i < 50000; ++i)
+      series.append(frame * 50000 + i, 0.5 * i);
+
+    plot.update();
+  }
+}
+
+int main() {
+  {
+    Plot plot("async off");
+    auto series = plot.createSeries("data");
+
+    plot.async(true);
+    writeFrames(plot, series);
+    plot.async(false);
+  }
+
+  {
+    Plot plot("destroyed");
+    auto series = plot.createSeries("data");
+
+    plot.async(true);
+    writeFrames(plot, series);
+  }
+
+  std::puts("ok");
+  return 0;
+}